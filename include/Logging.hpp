@@ -27,6 +27,8 @@
   *  // outputs: (matching on "!!WARNING!!" is useful for monitoring scripts)
   *  22:28:09.568508 LoggingTest.cpp:84 !!WARNING!! String still contains 'testMe' which is 6 characters long
   *
+  *  LOG_INFO("String contains '{}' which is {} characters long", s, s.size()); // std::format style, checked at compile time
+  *
   *  FATAL("That's all '%s'", s.c_str());
   *  // outputs: (and throws an exception, matching on "!!FATAL!!" is useful for monitoring scripts)
   *  22:28:09.568509 LoggingTest.cpp:86 !!WARNING!! !!FATAL!! That's all 'testMe'
@@ -34,12 +36,22 @@
   *  // to log arbitrary data directly to a FILE* from the background. Note that this has no gcc compile-time format checking currently
   *  Logging::fprintf(stdout, "This is a test of straight logging on line %ld.\n", __LINE__);
   *
+  *  // files written (and rotated) by the background thread: trades.log.0, trades.log.1, ...
+  *  LoggingHelper::RotatingFileConfig cfg;
+  *  cfg.path = "trades.log";
+  *  cfg.maxBytes = 256 << 20;
+  *  auto* trades = Logging::openFile("trades", cfg);
+  *  Logging::fprintf(trades, "Filled %ld@%.2f\n", qty, px);
+  *  Logging::redirect(stdout, trades); // INFO() now goes there too
+  *
 ***/
 
 #ifndef LOGGING_HEADER_DEFINE
 #define LOGGING_HEADER_DEFINE
 
 #include "LoggingHelper.hpp"
+#include "LoggingFormatString.hpp"
+#include "LoggingSites.hpp"
 #include "MessageQueue.hpp"
 
 #include <boost/mpl/string.hpp>
@@ -52,15 +64,22 @@
 #include <iostream>
 #include <fstream>
 #include <signal.h>
+#include <mutex>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 // seems to take 10-40 micros with regular printf
 
+// every macro call site gets a switch (see LoggingSites.hpp), checked before anything else is done
+#define LOGGING_SITE(A) \
+  static const uint32_t _log_slot = ::LoggingHelper::SiteTable::add(__FILE__, __LINE__, A); \
+  if (__builtin_expect(!::LoggingHelper::SiteTable::on(_log_slot), 0)) break
+
 #define INFO(A,...) do { \
-  const auto& _info_tm = LoggingHelper::Util::util()->timeParts(); \
+  LOGGING_SITE(A); \
+  const auto& _info_tm = LoggingHelper::Policy::timeParts(); \
   if (::detail::LoggingBackgroundThread::on()) { \
-    ::detail::LoggingBackgroundThread::instance()->fprintf(stdout,         \
-        "%02d:%02d:%02d.%06ld %s:" "%d " A "\n",std::get<0>(_info_tm), std::get<1>(_info_tm), std::get<2>(_info_tm), \
-        std::get<3>(_info_tm), Logging::ForwardFilename(__FILE__),__LINE__,##__VA_ARGS__); \
+    ::detail::LoggingBackgroundThread::instance()->log(::LoggingHelper::Lane::NORMAL, stdout, _info_tm, __FILE__, __LINE__, A "\n",##__VA_ARGS__); \
   } else { \
     fprintf(stdout, \
         "%02d:%02d:%02d.%06ld %s:" "%d " A "\n",std::get<0>(_info_tm), std::get<1>(_info_tm), std::get<2>(_info_tm), \
@@ -70,11 +89,15 @@
 
 // note: WARN() define conflicts with one used by Rcpp
 #define ZZWARN(A,...) do { \
-  const auto& _info_tm = LoggingHelper::Util::util()->timeParts(); \
+  LOGGING_SITE(A); \
+  LOGGING_WARN_LINE(A,##__VA_ARGS__); \
+} while (0)
+
+// ZZWARN() without a site switch (for FATAL(), which can't be switched off)
+#define LOGGING_WARN_LINE(A,...) do { \
+  const auto& _info_tm = LoggingHelper::Policy::timeParts(); \
   if (::detail::LoggingBackgroundThread::on()) { \
-    ::detail::LoggingBackgroundThread::instance()->fprintf(stderr,         \
-        "%02d:%02d:%02d.%06ld %s:" "%d !!WARNING!! " A "\n",std::get<0>(_info_tm), std::get<1>(_info_tm), std::get<2>(_info_tm), \
-        std::get<3>(_info_tm), Logging::ForwardFilename(__FILE__),__LINE__,##__VA_ARGS__); \
+    ::detail::LoggingBackgroundThread::instance()->log(::LoggingHelper::Lane::HIGH, stderr, _info_tm, __FILE__, __LINE__, "!!WARNING!! " A "\n",##__VA_ARGS__); \
   } else { \
     fprintf(stderr, \
         "%02d:%02d:%02d.%06ld %s:" "%d " A "\n",std::get<0>(_info_tm), std::get<1>(_info_tm), std::get<2>(_info_tm), \
@@ -82,13 +105,67 @@
   } \
 } while (0)
 
+// the line is written out (& flushed) before the exception is thrown
 #define FATAL(A,...) do { \
-  ZZWARN("!!FATAL!! " A,##__VA_ARGS__); \
+  LOGGING_WARN_LINE("!!FATAL!! " A,##__VA_ARGS__); \
+  ::Logging::flushHighPriority(); \
+  throw std::runtime_error("Fatal exception thrown. See log for details."); \
+} while (0)
+
+// std::format style: LOG_INFO("{} is {:.2f}", name, px). The format is checked against the arguments at compile
+// time, & the arguments (strings included) are copied so that all the formatting happens on the background thread
+#define LOG_INFO(A,...) do { \
+  LOGGING_SITE(A); \
+  static ::LoggingHelper::LogSite _log_site = { __FILE__, __LINE__, A "\n" }; \
+  ::Logging::logFormat(stdout, _log_site, A "\n",##__VA_ARGS__); \
+} while (0)
+
+#define LOG_WARN(A,...) do { \
+  LOGGING_SITE(A); \
+  LOGGING_LOG_WARN_LINE(A,##__VA_ARGS__); \
+} while (0)
+
+// LOG_WARN() without a site switch (for LOG_FATAL())
+#define LOGGING_LOG_WARN_LINE(A,...) do { \
+  static ::LoggingHelper::LogSite _log_site = { __FILE__, __LINE__, "!!WARNING!! " A "\n", ::LoggingHelper::Lane::HIGH }; \
+  ::Logging::logFormat(stderr, _log_site, "!!WARNING!! " A "\n",##__VA_ARGS__); \
+} while (0)
+
+// logs the line, then (up to Config::binaryMaxBytes of) the len bytes at p as a hexdump or base64. The bytes are
+// just copied into the record, so this costs the hot thread about a memcpy
+#define LOG_HEX(P,N,A,...) do { \
+  LOGGING_SITE(A); \
+  static ::LoggingHelper::LogSite _log_site = { __FILE__, __LINE__, A "\n" }; \
+  ::Logging::logHex(stdout, _log_site, P, N, A "\n",##__VA_ARGS__); \
+} while (0)
+
+#define LOG_FATAL(A,...) do { \
+  LOGGING_LOG_WARN_LINE("!!FATAL!! " A,##__VA_ARGS__); \
+  ::Logging::flushHighPriority(); \
   throw std::runtime_error("Fatal exception thrown. See log for details."); \
 } while (0)
 
 class Logging {
   public:
+    struct Config {
+      size_t queueCapacity = Salvo::MessageQueueTraits::defaultSize; // records that can be queued (a power of two)
+      size_t highQueueCapacity = 256; // the same, for ZZWARN(), FATAL() etc. (served ahead of everything else)
+      bool suppressRepeats = false;   // collapse runs of identical lines (same call site & arguments) to one & a count
+      int64_t repeatReportMillis = 1000; // while such a run goes on, write its count out at least this often
+      size_t slotSize = 1024 * 16;  // bytes per record: the format pointer, arguments & copies of any strings
+      bool prefault = true;         // touch every page of the queue up front
+      int consumerCpu = -1;         // pin the background thread to this cpu before init() returns (-1 for no pinning)
+      bool warmUp = true;           // push some records through to a NullSink, so the code & data paths are warm
+      bool pollMode = false;        // no background thread: the application calls Logging::poll() (e.g. from its event loop)
+      size_t binaryMaxBytes = 256;  // LOG_HEX() copies at most this many bytes (& the rest of the slot limits it too)
+      LoggingHelper::BinaryFormat binaryFormat = LoggingHelper::BinaryFormat::HEXDUMP;
+      std::string siteControl;      // if set, the per call site switches go in /dev/shm/<this>, for logctl to flip
+      bool backtest = false;        // poll mode, timestamped by the simulated clock Logging::step() moves, & never sleeping
+    };
+    // Optional: creates the background thread & its queue now (rather than on the first log call). Call it once,
+    // before anything is logged
+    static void init(const Config& config);
+    static void init() { init(Config()); }
     static const char* ForwardFilename(const char* c) {
       do {
         const char* b = c;
@@ -98,6 +175,35 @@ class Logging {
       } while (1);
     }
     static void sync(); 
+    // waits until every ZZWARN()/FATAL() etc. line logged so far has been written out & flushed (FATAL() calls this
+    // before throwing)
+    static void flushHighPriority();
+    // turns the logging macro call sites matching 'site' ("*", a file name or file:line) on or off. Sites are known
+    // once they've run. Returns the number switched
+    static size_t enableSites(const std::string& site, bool on = true) { return LoggingHelper::SiteTable::set(site, on); }
+    // a record's place in its queue. Every logging call sets the calling thread's lastTicket() (& fprintf() etc. return it)
+    struct Ticket {
+      LoggingHelper::Lane lane = LoggingHelper::Lane::NORMAL;
+      int64_t seq = 0; // records logged to the lane up to & including this one
+    };
+    static Ticket& lastTicket() {
+      static thread_local Ticket t;
+      return t;
+    }
+    // blocks until the ticket's record (& so everything before it in its lane, but nothing after) has been written out &
+    // flushed, & with fsync until it's been fsynced too. Returns false if that took longer than timeoutNanos
+    static bool flushUntil(const Ticket& ticket, int64_t timeoutNanos = INT64_MAX, bool fsync = false);
+    static bool flushUntil(int64_t timeoutNanos = INT64_MAX, bool fsync = false) {
+      return flushUntil(lastTicket(), timeoutNanos, fsync);
+    }
+    // with Config::pollMode, formats & writes out up to maxRecords queued lines on the calling thread, stopping early
+    // once maxNanos have passed (checked after each line). Returns the number of lines written. Output is flushed (& file
+    // sinks rotated) when a poll finds nothing to do
+    static size_t poll(size_t maxRecords = SIZE_MAX, int64_t maxNanos = INT64_MAX);
+    // with Config::backtest, at the end of each simulation step: writes out everything logged so far (timestamped with
+    // the step's time), then moves the simulated clock to nanos (since the epoch) for the lines the next step logs.
+    // Returns the number of lines written. Output's left buffered until sync() or the buffers fill
+    static size_t step(int64_t nanos);
     static bool& yieldViaSleep() { // set to true if we want to call sleep when syncing() (i.e., in qa or backtest)
       static bool b = false;
       return b;
@@ -106,103 +212,469 @@ class Logging {
       static bool b = false;
       return b;
     }
-    template<typename... Args> static void fprintf(FILE* file, const char * format, Args... args);
+    // tags every line the calling thread logs from now on with "[context] " after its file:line. The string's copied
+    // once, here (& registered for good), & lines carry just its id. Returns the id, which other threads can share
+    // with setThreadContext(id). An empty context (or id 0) removes the tag
+    static uint16_t setThreadContext(std::string_view context) {
+      uint16_t id = LoggingHelper::ThreadContexts::contexts().id(context);
+      setThreadContext(id);
+      return id;
+    }
+    static void setThreadContext(uint16_t id) { LoggingHelper::ThreadContexts::current() = id; }
+    template<typename... Args> static Ticket fprintf(FILE* file, const char * format, Args... args);
+    template<typename... Args> static Ticket fprintf(LoggingHelper::Sink* sink, const char * format, Args... args);
+    // LOG_INFO() etc.
+    template<typename... Args> static Ticket logFormat(FILE* file, const LoggingHelper::LogSite& site,
+        LoggingHelper::FormatString<std::type_identity_t<Args>...> format, const Args&... args);
+    // LOG_HEX()
+    template<typename... Args> static Ticket logHex(FILE* file, const LoggingHelper::LogSite& site, const void* data, size_t len,
+        LoggingHelper::FormatString<std::type_identity_t<Args>...> format, const Args&... args);
+
+    // creates a named file sink that only the background thread writes to (and will close on exit)
+    static LoggingHelper::Sink* openFile(const std::string& name, const LoggingHelper::RotatingFileConfig& config) {
+      return LoggingHelper::SinkRegistry::registry().add(name, new LoggingHelper::RotatingFileSink(config));
+    }
+    static LoggingHelper::Sink* sink(const std::string& name) { return LoggingHelper::SinkRegistry::registry().find(name); }
+    // anything logged to 'file' (e.g. stdout for INFO, stderr for ZZWARN) is written to 'sink' instead (NULL to undo).
+    // Set this up before logging to 'file'
+    static void redirect(FILE* file, LoggingHelper::Sink* sink) { LoggingHelper::SinkRegistry::registry().redirect(file, sink); }
 };
 
 namespace detail {
   class LoggingBackgroundThread {
     public:
+      struct alignas(64) Slot { char _data[64]; }; // records start on a cache line (& are at least this big)
+      using Queue = Salvo::RuntimeMessageQueue<Slot>;
       static bool& on() { // call on() == false to turn off logging
         static bool b = true;
         return(b);
       }
       static LoggingBackgroundThread* instance() {
-        if (_instance == NULL) _instance = new LoggingBackgroundThread();
-        return _instance;
+        LoggingBackgroundThread* i = _instance.load(std::memory_order_acquire);
+        if (__builtin_expect(i == NULL, 0)) { // nobody called Logging::init(), so start up with the defaults now
+          Logging::Config config;
+          config.prefault = false;
+          config.warmUp = false;
+          i = create(config, false);
+        }
+        return i;
+      }
+      static LoggingBackgroundThread* create(const Logging::Config& config, bool explicitInit) {
+        static std::mutex m;
+        std::lock_guard<std::mutex> lock(m);
+        LoggingBackgroundThread* i = _instance.load();
+        if (i != NULL) {
+          if (explicitInit) throw std::runtime_error("Logging::init() called after logging had already started");
+          return i;
+        }
+        i = new LoggingBackgroundThread(config);
+        _instance.store(i, std::memory_order_release);
+        return i;
       }
-      LoggingBackgroundThread() {
-        pthread_create(&bg_thread, NULL, &run, (void*)this);
+      explicit LoggingBackgroundThread(const Logging::Config& config):
+        _config(config), _mq(config.queueCapacity, config.slotSize, config.prefault),
+        _hq(config.highQueueCapacity, config.slotSize, config.prefault) {
+        if (config.slotSize < 256) throw std::invalid_argument("Logging::Config::slotSize is too small");
+        if (_config.backtest) _config.pollMode = true;
+        if (_config.pollMode) {
+          _started = true;
+        } else {
+          pthread_create(&bg_thread, NULL, &run, (void*)this);
+          while (!_started) sched_yield();
+        }
+        if (config.warmUp) warmUp();
+      }
+      void warmUp() {
+        static auto* nullSink = new LoggingHelper::NullSink();
+        const auto& tm = ::LoggingHelper::Policy::timeParts();
+        for (int i = 0; i < 64; ++i) {
+          log(i % 4 ? LoggingHelper::Lane::NORMAL : LoggingHelper::Lane::HIGH, nullSink, tm, __FILE__, __LINE__,
+              "Warming up %d %ld %.6f %s\n", i, int64_t(i), i * 0.5, "logger");
+          fprintf(nullSink, "%d\n", i);
+        }
+        sync();
       }
       inline static void* run(void *vself) {
         static bool switchedToJunk = false;
         auto* self = reinterpret_cast<LoggingBackgroundThread*>(vself);
+        if (self->_config.consumerCpu >= 0) {
+          ::LoggingHelper::Policy::setThreadAffinity(self->_config.consumerCpu);
+        }
+        self->_started = true;
         while (!self->_exit) {
           if (Logging::logOnJunk() && !switchedToJunk) {
             ::fprintf(stderr, "Setting logger affinity\n");
-            ::LoggingHelper::Util::util()->setJunkThreadAffinity();
+            ::LoggingHelper::Policy::setJunkThreadAffinity();
             switchedToJunk = true;
           }
-          auto msgp = self->_mq.recv(self->_readCount);
-          if (msgp) {
-            try {
-              const auto* p = reinterpret_cast<const LoggingHelper::Printer*>(&(msgp->front()));
-              p->print();
-            } catch (const std::exception& e) {
-              static int whingeCount = 0;
-              if (++whingeCount < 100) {
-                ::fprintf(stderr, "!!WARNING!! Exception caught in background logger: %s\n", e.what());
-                try {
-                  const auto* p = reinterpret_cast<const LoggingHelper::Printer*>(&(msgp->front()));
-                  ::fprintf(stderr, "Format line was '%s'\n", p->getFormat());
-                } catch (...) { }
-              } else if (whingeCount == 100) {
-                ::fprintf(stderr, "!!WARNING!! Background logger will stop whinging now\n");
-              }
+          if (self->drain(1024, INT64_MAX) == 0) {
+            if (self->tryLockDrain()) { // (unless a FATAL() is writing its line out itself)
+              self->flushOutput();
+              self->unlockDrain();
             }
-          } else {
-            ::fflush(NULL);
-            ::LoggingHelper::Util::util()->realUSleep(10LL * 1000 - 1); // sleep 10ms (-1 micro, to distinguish this call)
+            ::LoggingHelper::Policy::realUSleep(10LL * 1000 - 1); // sleep 10ms (-1 micro, to distinguish this call)
           }
         }
+        self->_repeats.report();
         self->_finished = true;
         return nullptr;
       }
-      ~LoggingBackgroundThread() {
-        while (_readCount != _mq.writeCount()) {
-          ::LoggingHelper::Util::util()->realUSleep(1000 * 10);
+      static int64_t monotonicNanos() {
+        timespec tp;
+        clock_gettime(CLOCK_MONOTONIC, &tp);
+        return int64_t(tp.tv_sec) * 1000 * 1000 * 1000 + tp.tv_nsec;
+      }
+      // what anything that shows up in the output is timed by (the simulated clock in a backtest)
+      int64_t outputNanos() const {
+        return _config.backtest ? ::LoggingHelper::SimulatedClock::nanos().load(std::memory_order_relaxed) : monotonicNanos();
+      }
+      // waits a little for another thread to get something done. A backtest just spins: it never sleeps or yields
+      void backOff() {
+        if (_config.backtest) return;
+        if (Logging::yieldViaSleep()) {
+          ::LoggingHelper::Policy::realUSleep(1000*100);
+        } else {
+          sched_yield();
         }
-        _exit = true;
-        while (!_finished) { 
-          ::LoggingHelper::Util::util()->realUSleep(1000 * 10);
+      }
+      void print(const LoggingHelper::Printer* p) {
+        if (_config.suppressRepeats && !_repeats.pass(p)) {
+          if (_repeatsSince < 0) _repeatsSince = outputNanos();
+          return;
+        }
+        if (!_repeats.pending()) _repeatsSince = -1;
+        try {
+          p->print();
+        } catch (const std::exception& e) {
+          static int whingeCount = 0;
+          if (++whingeCount < 100) {
+            ::fprintf(stderr, "!!WARNING!! Exception caught in background logger: %s\n", e.what());
+            try {
+              ::fprintf(stderr, "Format line was '%s'\n", p->getFormat());
+            } catch (...) { }
+          } else if (whingeCount == 100) {
+            ::fprintf(stderr, "!!WARNING!! Background logger will stop whinging now\n");
+          }
         }
       }
-      void sync() const {
-        while (int64_t(_mq.writeCount()) != int64_t(_readCount)) {
-          if (Logging::yieldViaSleep()) {
-            ::LoggingHelper::Util::util()->realUSleep(1000*100);
+      // only one thread formats & writes at a time (the background thread, or in poll mode whoever gets this)
+      bool tryLockDrain() { return !_draining.exchange(true, std::memory_order_acquire); }
+      void unlockDrain() { _draining.store(false, std::memory_order_release); }
+      size_t drain(size_t maxRecords, int64_t maxNanos) {
+        if (!tryLockDrain()) return 0;
+        size_t n = drainLocked(maxRecords, maxNanos);
+        unlockDrain();
+        return n;
+      }
+      bool printNext(Queue& q, std::atomic<int64_t>& readCount) {
+        auto msgp = q.recv(readCount);
+        if (!msgp) return false;
+        print(reinterpret_cast<const LoggingHelper::Printer*>(&(*msgp)));
+        return true;
+      }
+      // formats & writes out up to maxRecords queued records (the high priority lane first, which is flushed as soon
+      // as it's empty), stopping once maxNanos have passed
+      size_t drainLocked(size_t maxRecords, int64_t maxNanos) {
+        int64_t start = (maxNanos == INT64_MAX) ? 0 : monotonicNanos();
+        size_t n = 0;
+        while (n < maxRecords) {
+          if (printNext(_hq, _highReadCount)) {
+            _highUnflushed = true;
           } else {
-            sched_yield();
+            if (_highUnflushed) flushOutput();
+            if (!printNext(_mq, _readCount)) break;
           }
+          ++n;
+          if (maxNanos != INT64_MAX && monotonicNanos() - start >= maxNanos) break;
         }
+        if (_highUnflushed || (n != 0 && _waiters.load() != 0)) flushOutput(); // (don't keep flushUntil() waiting)
+        return n;
       }
-      template <typename... Params>
-      void fprintf(FILE *f, const char* fmt, Params... params) {
-        while (int64_t(_mq.writeCount()) - int64_t(_readCount) >= int64_t(_mq.capacity())-1) {
-          if (Logging::yieldViaSleep()) {
-            ::LoggingHelper::Util::util()->realUSleep(1000*100);
-          } else {
+      void flushHighPriority() {
+        int64_t target = _hq.writeCount();
+        while (flushed(LoggingHelper::Lane::HIGH).load(std::memory_order_acquire) < target) {
+          if (tryLockDrain()) { // write it out ourselves, rather than waiting for the background thread to wake up
+            while (printNext(_hq, _highReadCount)) { }
+            flushOutput();
+            unlockDrain();
+          } else if (!_config.backtest) {
             sched_yield();
           }
         }
-        auto wrt = _mq.nextWriteSlot();
-        LoggingHelper::Printer::createPrinter<sizeof(*wrt)>(f, &(wrt->front()), fmt, params...);
       }
-      static LoggingBackgroundThread* _instance;
+      // (called with the drain lock held) writes out the count of a run of repeats that's gone on long enough
+      void reportRepeats() {
+        if (_repeatsSince >= 0 && outputNanos() - _repeatsSince >= _config.repeatReportMillis * 1000 * 1000) {
+          _repeats.report();
+          _repeatsSince = -1;
+        }
+      }
+      // (called with the drain lock held) flushes everything written so far, & tells any flushUntil() callers
+      void flushOutput() {
+        reportRepeats();
+        ::fflush(NULL);
+        ::LoggingHelper::SinkRegistry::registry().flushAll();
+        _highUnflushed = false;
+        int64_t normal = _readCount, high = _highReadCount;
+        if (_syncWaiters.load() != 0) {
+          ::fsync(fileno(stdout));
+          ::fsync(fileno(stderr));
+          ::LoggingHelper::SinkRegistry::registry().syncAll();
+          _synced[0].store(normal, std::memory_order_release);
+          _synced[1].store(high, std::memory_order_release);
+        }
+        _flushed[0].store(normal);
+        _flushed[1].store(high);
+        if (_waiters.load() != 0) {
+          _flushEpoch.fetch_add(1);
+          syscall(SYS_futex, &_flushEpoch, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+        }
+      }
+      std::atomic<int64_t>& flushed(LoggingHelper::Lane lane) { return _flushed[size_t(lane)]; }
+      bool flushUntil(const Logging::Ticket& ticket, int64_t timeoutNanos, bool fsync) {
+        auto& done = fsync ? _synced[size_t(ticket.lane)] : _flushed[size_t(ticket.lane)];
+        if (done.load(std::memory_order_acquire) >= ticket.seq) return true;
+        int64_t deadline = (timeoutNanos == INT64_MAX) ? INT64_MAX : monotonicNanos() + timeoutNanos;
+        _waiters.fetch_add(1);
+        if (fsync) _syncWaiters.fetch_add(1);
+        bool ok = false;
+        while (true) {
+          uint32_t epoch = _flushEpoch.load();
+          if (done.load(std::memory_order_acquire) >= ticket.seq) {
+            ok = true;
+            break;
+          }
+          if (tryLockDrain()) { // nobody's writing, so write out just enough to get to our record ourselves
+            const Queue& q = queue(ticket.lane);
+            const auto& readCount = (ticket.lane == LoggingHelper::Lane::HIGH) ? _highReadCount : _readCount;
+            if (readCount < ticket.seq && ticket.seq <= q.writeCount()) {
+              drainLocked(size_t(_hq.writeCount() - _highReadCount + ticket.seq - readCount), INT64_MAX);
+            }
+            flushOutput();
+            unlockDrain();
+            if (done.load(std::memory_order_acquire) >= ticket.seq) {
+              ok = true;
+              break;
+            }
+          }
+          int64_t now = monotonicNanos();
+          if (now >= deadline) break;
+          // wakes on the next flush, or after 10ms to check whether the lock's free (e.g. a poll mode poll() stopped short)
+          int64_t wait = std::min<int64_t>(deadline - now, 10LL * 1000 * 1000);
+          timespec ts = { time_t(wait / 1000000000), long(wait % 1000000000) };
+          syscall(SYS_futex, &_flushEpoch, FUTEX_WAIT_PRIVATE, epoch, &ts, nullptr, 0);
+        }
+        if (fsync) _syncWaiters.fetch_sub(1);
+        _waiters.fetch_sub(1);
+        return ok;
+      }
+      size_t poll(size_t maxRecords, int64_t maxNanos) {
+        if (!_config.pollMode || !tryLockDrain()) return 0; // (the background thread, or another poll() has it)
+        size_t n = drainLocked(maxRecords, maxNanos);
+        if (n != 0) {
+          _unflushed = true;
+        } else { // idle: flush what we wrote, & tick the sinks every 10ms or so (as the background thread would)
+          int64_t now = monotonicNanos();
+          if (_unflushed || now - _lastFlushNanos >= 10LL * 1000 * 1000) {
+            flushOutput();
+            _unflushed = false;
+            _lastFlushNanos = now;
+          }
+        }
+        unlockDrain();
+        return n;
+      }
+      size_t step(int64_t nanos) {
+        if (!_config.backtest) throw std::logic_error("Logging::step() needs Logging::Config::backtest");
+        while (!tryLockDrain()) { } // (only if another thread's logging & filling the queue)
+        size_t n = drainLocked(SIZE_MAX, INT64_MAX);
+        reportRepeats();
+        unlockDrain();
+        ::LoggingHelper::SimulatedClock::nanos().store(nanos, std::memory_order_relaxed);
+        return n;
+      }
+      ~LoggingBackgroundThread() {
+        if (_config.pollMode) {
+          sync();
+          _repeats.report();
+          ::LoggingHelper::SinkRegistry::registry().closeAll();
+          return;
+        }
+        while (_readCount != _mq.writeCount() || _highReadCount != _hq.writeCount()) {
+          ::LoggingHelper::Policy::realUSleep(1000 * 10);
+        }
+        _exit = true;
+        while (!_finished) { 
+          ::LoggingHelper::Policy::realUSleep(1000 * 10);
+        }
+        ::LoggingHelper::SinkRegistry::registry().closeAll();
+      }
+      void sync() {
+        while (int64_t(_mq.writeCount()) != int64_t(_readCount) || int64_t(_hq.writeCount()) != int64_t(_highReadCount)) {
+          if (_config.pollMode && drain(SIZE_MAX, INT64_MAX) != 0) continue;
+          backOff();
+        }
+        if (_config.pollMode && tryLockDrain()) {
+          flushOutput();
+          _unflushed = false;
+          unlockDrain();
+        }
+      }
+      Queue& queue(LoggingHelper::Lane lane) { return lane == LoggingHelper::Lane::HIGH ? _hq : _mq; }
+      void waitForSpace(LoggingHelper::Lane lane) {
+        const Queue& q = queue(lane);
+        const std::atomic<int64_t>& readCount = (lane == LoggingHelper::Lane::HIGH) ? _highReadCount : _readCount;
+        while (int64_t(q.writeCount()) - int64_t(readCount) >= int64_t(q.capacity())-1) {
+          if (_config.pollMode && drain(1, INT64_MAX) != 0) continue; // make room ourselves
+          backOff();
+        }
+      }
+      // (once the record's published) makes it the calling thread's Logging::lastTicket()
+      Logging::Ticket issue(LoggingHelper::Lane lane) {
+        auto& t = Logging::lastTicket();
+        t = { lane, queue(lane).writeCount() };
+        return t;
+      }
+      template <typename Out, typename... Params>
+      Logging::Ticket fprintf(Out *f, const char* fmt, Params... params) {
+        waitForSpace(LoggingHelper::Lane::NORMAL);
+        {
+          auto wrt = _mq.nextWriteSlot();
+          LoggingHelper::Printer::createCopyingPrinter(_mq.slotSize(), f, &(*wrt), fmt, params...);
+        }
+        return issue(LoggingHelper::Lane::NORMAL);
+      }
+      // a line from INFO() etc: the "HH:MM:SS.uuuuuu file:line " prefix is rendered by the background thread
+      template <typename Out, typename... Params>
+      Logging::Ticket log(LoggingHelper::Lane lane, Out *f, const std::tuple<int, int, int, int64_t>& tm, const char* file,
+          int line, const char* fmt, Params... params) {
+        waitForSpace(lane);
+        {
+          Queue& q = queue(lane);
+          auto wrt = q.nextWriteSlot();
+          auto* p = LoggingHelper::Printer::createPrinter(q.slotSize(), f, &(*wrt), fmt, params...);
+          p->setPrefix(tm, file, line);
+        }
+        return issue(lane);
+      }
+      // a line from LOG_INFO() etc.
+      template <typename Out, typename... Args>
+      Logging::Ticket logFormat(Out *f, const std::tuple<int, int, int, int64_t>& tm, const LoggingHelper::LogSite& site,
+          const Args&... args) {
+        waitForSpace(site.lane);
+        {
+          Queue& q = queue(site.lane);
+          auto wrt = q.nextWriteSlot();
+          LoggingHelper::createBracePrinter(q.slotSize(), f, &(*wrt), tm, site, args...);
+        }
+        return issue(site.lane);
+      }
+      // a line from LOG_HEX()
+      template <typename Out, typename... Args>
+      Logging::Ticket logHex(Out *f, const std::tuple<int, int, int, int64_t>& tm, const LoggingHelper::LogSite& site,
+          const void* data, size_t len, const Args&... args) {
+        waitForSpace(site.lane);
+        {
+          Queue& q = queue(site.lane);
+          auto wrt = q.nextWriteSlot();
+          LoggingHelper::Bytes bytes = { data, uint32_t(std::min(len, _config.binaryMaxBytes)), uint32_t(len) };
+          LoggingHelper::createBinaryPrinter(q.slotSize(), f, &(*wrt), tm, site, _config.binaryFormat, bytes, args...);
+        }
+        return issue(site.lane);
+      }
+      static std::atomic<LoggingBackgroundThread*> _instance;
       pthread_t bg_thread;
+      std::atomic<bool> _started = false;
       std::atomic<bool> _exit = false;
       std::atomic<bool> _finished = false;
-      Salvo::MessageQueue<std::array<char,1024*16> > _mq;
+      Logging::Config _config;
+      Queue _mq;
+      Queue _hq;                    // the high priority lane (ZZWARN(), FATAL(), LOG_WARN() etc.)
       std::atomic<int64_t> _readCount=0;
+      std::atomic<int64_t> _highReadCount=0;
+      std::atomic<int64_t> _flushed[2] = {0, 0}; // records written out & flushed, by lane (as Logging::Ticket::seq)
+      std::atomic<int64_t> _synced[2] = {0, 0};  // the same, fsynced
+      std::atomic<uint32_t> _flushEpoch = 0;     // futex flushUntil() waits on, bumped by each flush while _waiters
+      std::atomic<int> _waiters = 0;
+      std::atomic<int> _syncWaiters = 0;
+      std::atomic<bool> _draining = false;
+      bool _unflushed = false;      // poll mode: lines written since the last flush (these two are guarded by _draining)
+      int64_t _lastFlushNanos = 0;
+      bool _highUnflushed = false;
+      LoggingHelper::RepeatFilter _repeats; // Config::suppressRepeats (guarded by _draining too)
+      int64_t _repeatsSince = -1;           // when the current run of repeats started (-1 if none)
 
   };
 }
+inline void Logging::init(const Config& config) {
+  if constexpr (std::is_same_v<LoggingHelper::Policy, LoggingHelper::InlinePolicy>) { // (which reads the real clock)
+    if (config.backtest) throw std::invalid_argument("Logging::Config::backtest needs UtilPolicy or SimulatedPolicy");
+  }
+  detail::LoggingBackgroundThread::create(config, true);
+  if (config.backtest) {
+    if (LoggingHelper::SimulatedClock::nanos().load() < 0) LoggingHelper::SimulatedClock::nanos().store(0);
+    if constexpr (std::is_same_v<LoggingHelper::Policy, LoggingHelper::UtilPolicy>) {
+      LoggingHelper::Util::util() = new LoggingHelper::SimulatedUtil(LoggingHelper::Util::util());
+    }
+  }
+  if (!config.siteControl.empty()) LoggingHelper::SiteTable::attach(config.siteControl);
+}
 inline void Logging::sync() { 
-  if (detail::LoggingBackgroundThread::_instance != NULL) {
-    detail::LoggingBackgroundThread::_instance->sync();
+  auto* instance = detail::LoggingBackgroundThread::_instance.load(std::memory_order_acquire);
+  if (instance != NULL) {
+    instance->sync();
+  }
+}
+inline void Logging::flushHighPriority() {
+  auto* instance = detail::LoggingBackgroundThread::_instance.load(std::memory_order_acquire);
+  if (instance != NULL && detail::LoggingBackgroundThread::on()) {
+    instance->flushHighPriority();
+  }
+}
+inline size_t Logging::poll(size_t maxRecords, int64_t maxNanos) {
+  auto* instance = detail::LoggingBackgroundThread::_instance.load(std::memory_order_acquire);
+  return instance == NULL ? 0 : instance->poll(maxRecords, maxNanos);
+}
+inline size_t Logging::step(int64_t nanos) {
+  auto* instance = detail::LoggingBackgroundThread::_instance.load(std::memory_order_acquire);
+  if (instance == NULL) throw std::logic_error("Logging::step() needs Logging::init() with Config::backtest");
+  return instance->step(nanos);
+}
+inline bool Logging::flushUntil(const Ticket& ticket, int64_t timeoutNanos, bool fsync) {
+  auto* instance = detail::LoggingBackgroundThread::_instance.load(std::memory_order_acquire);
+  return instance == NULL || ticket.seq == 0 || instance->flushUntil(ticket, timeoutNanos, fsync);
+}
+template<typename... Args> Logging::Ticket Logging::fprintf(FILE* file, const char * format, Args... args) {
+  return ::detail::LoggingBackgroundThread::instance()->fprintf(file, format, args...);
+}
+template<typename... Args> Logging::Ticket Logging::fprintf(LoggingHelper::Sink* sink, const char * format, Args... args) {
+  return ::detail::LoggingBackgroundThread::instance()->fprintf(sink, format, args...);
+}
+template<typename... Args> Logging::Ticket Logging::logFormat(FILE* file, const LoggingHelper::LogSite& site,
+    LoggingHelper::FormatString<std::type_identity_t<Args>...>, const Args&... args) {
+  const auto& tm = LoggingHelper::Policy::timeParts();
+  if (::detail::LoggingBackgroundThread::on()) {
+    return ::detail::LoggingBackgroundThread::instance()->logFormat(file, tm, site, args...);
+  } else {
+    auto& fmt = LoggingHelper::formatNow(tm, site, args...);
+    fwrite(fmt.data(), fmt.size(), 1, file);
+    return Ticket();
   }
 }
-template<typename... Args> void Logging::fprintf(FILE* file, const char * format, Args... args) {
-  ::detail::LoggingBackgroundThread::instance()->fprintf(file, format, args...);
+template<typename... Args> Logging::Ticket Logging::logHex(FILE* file, const LoggingHelper::LogSite& site, const void* data, size_t len,
+    LoggingHelper::FormatString<std::type_identity_t<Args>...>, const Args&... args) {
+  const auto& tm = LoggingHelper::Policy::timeParts();
+  if (::detail::LoggingBackgroundThread::on()) {
+    return ::detail::LoggingBackgroundThread::instance()->logHex(file, tm, site, data, len, args...);
+  } else {
+    auto* instance = ::detail::LoggingBackgroundThread::_instance.load(std::memory_order_acquire);
+    Config config = instance ? instance->_config : Config();
+    auto& fmt = LoggingHelper::formatNow(tm, site, args...);
+    size_t copied = std::min(len, config.binaryMaxBytes);
+    LoggingHelper::renderBinary(fmt, config.binaryFormat, LoggingHelper::Bytes{ data, uint32_t(copied), uint32_t(len) });
+    fwrite(fmt.data(), fmt.size(), 1, file);
+    return Ticket();
+  }
 }
 
 #endif
@@ -0,0 +1,48 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+
+/** The simulated clock a backtest logs with (used by Logging.h & the sinks) **/
+
+#ifndef LOGGING_CLOCK_DEFINE
+#define LOGGING_CLOCK_DEFINE
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+namespace LoggingHelper {
+  // With Logging::Config::backtest, line timestamps, file rotation & the sidecar index all come from here rather than
+  // the real clock. It only moves when Logging::step() moves it, so replaying the same day writes the same bytes
+  struct SimulatedClock {
+    // nanos since the epoch, or -1 when not simulating
+    static std::atomic<int64_t>& nanos() {
+      static std::atomic<int64_t> n = -1;
+      return n;
+    }
+    static bool running() { return nanos().load(std::memory_order_relaxed) >= 0; }
+    // nanos since the epoch: simulated if running, else from the (coarse, cheap) real time clock
+    static int64_t realtimeNanos() {
+      int64_t n = nanos().load(std::memory_order_relaxed);
+      if (n >= 0) return n;
+      timespec tp;
+      clock_gettime(CLOCK_REALTIME_COARSE, &tp);
+      return int64_t(tp.tv_sec) * 1000 * 1000 * 1000 + tp.tv_nsec;
+    }
+  };
+}
+
+#endif
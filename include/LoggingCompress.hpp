@@ -0,0 +1,195 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+
+/**
+  * Streaming compressors for RotatingFileSink. Link with -lz, and -lzstd / -llz4 if those are used. e.g.:
+  *
+  *  LoggingHelper::RotatingFileConfig cfg;
+  *  cfg.path = "trades.log";
+  *  cfg.bufferBytes = 4 << 20; // the size of the blocks handed to the compressor
+  *  cfg.compressor = LoggingHelper::makeCompressor<LoggingHelper::ZstdCompressor>(); // trades.log.0.zst, ... (zstdcat-able)
+  *
+***/
+
+#ifndef LOGGING_COMPRESS_DEFINE
+#define LOGGING_COMPRESS_DEFINE
+
+#include "LoggingSink.hpp"
+#include <zlib.h>
+#include <algorithm>
+
+#if __has_include(<zstd.h>)
+#include <zstd.h>
+#define LOGGING_HAVE_ZSTD 1
+#endif
+#if __has_include(<lz4frame.h>)
+#include <lz4frame.h>
+#define LOGGING_HAVE_LZ4 1
+#endif
+
+namespace LoggingHelper {
+  // a RotatingFileConfig::compressor that makes a C(args...) for each file
+  template <typename C, typename... Args>
+  std::function<std::unique_ptr<Compressor>()> makeCompressor(Args... args) {
+    return [=]() { return std::unique_ptr<Compressor>(new C(args...)); };
+  }
+
+  // .gz files, readable with zcat/zgrep (& while still being written, up to the last idle flush)
+  class GzipCompressor: public Compressor {
+    public:
+      explicit GzipCompressor(int level = 1): _level(level) { }
+      ~GzipCompressor() { if (_open) deflateEnd(&_z); }
+      void compress(const char* buf, size_t len, std::vector<char>& out) override {
+        if (!_open) {
+          memset(&_z, 0, sizeof(_z));
+          if (deflateInit2(&_z, _level, Z_DEFLATED, 15 + 16 /* gzip header */, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("deflateInit2 failed");
+          }
+          _open = true;
+        }
+        run(buf, len, Z_NO_FLUSH, out);
+      }
+      void flush(std::vector<char>& out) override { if (_open) run(nullptr, 0, Z_SYNC_FLUSH, out); }
+      void finish(std::vector<char>& out) override {
+        if (_open) {
+          run(nullptr, 0, Z_FINISH, out);
+          deflateEnd(&_z);
+          _open = false;
+        }
+      }
+      const char* extension() const override { return ".gz"; }
+    private:
+      void run(const char* buf, size_t len, int mode, std::vector<char>& out) {
+        _z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(buf));
+        _z.avail_in = len;
+        do {
+          size_t at = out.size();
+          size_t room = std::max<size_t>(1 << 16, deflateBound(&_z, _z.avail_in));
+          out.resize(at + room);
+          _z.next_out = reinterpret_cast<Bytef*>(&out[at]);
+          _z.avail_out = room;
+          int rc = deflate(&_z, mode);
+          out.resize(at + room - _z.avail_out);
+          if (rc == Z_STREAM_ERROR) throw std::runtime_error("deflate failed");
+          if (mode == Z_FINISH ? rc == Z_STREAM_END : (_z.avail_in == 0 && _z.avail_out != 0)) break;
+        } while (1);
+      }
+      int _level;
+      bool _open = false;
+      z_stream _z;
+  };
+
+#ifdef LOGGING_HAVE_ZSTD
+  // .zst files, readable with zstdcat. Each rotated file is a single frame
+  class ZstdCompressor: public Compressor {
+    public:
+      explicit ZstdCompressor(int level = 1): _cctx(ZSTD_createCCtx()) {
+        if (_cctx == nullptr) throw std::runtime_error("ZSTD_createCCtx failed");
+        ZSTD_CCtx_setParameter(_cctx, ZSTD_c_compressionLevel, level);
+        ZSTD_CCtx_setParameter(_cctx, ZSTD_c_checksumFlag, 1);
+      }
+      ~ZstdCompressor() { ZSTD_freeCCtx(_cctx); }
+      void compress(const char* buf, size_t len, std::vector<char>& out) override {
+        _open = true;
+        run(buf, len, ZSTD_e_continue, out);
+      }
+      void flush(std::vector<char>& out) override { if (_open) run(nullptr, 0, ZSTD_e_flush, out); }
+      void finish(std::vector<char>& out) override {
+        if (_open) {
+          run(nullptr, 0, ZSTD_e_end, out);
+          _open = false;
+        }
+      }
+      const char* extension() const override { return ".zst"; }
+    private:
+      void run(const char* buf, size_t len, ZSTD_EndDirective mode, std::vector<char>& out) {
+        ZSTD_inBuffer in = { buf, len, 0 };
+        size_t remaining;
+        do {
+          size_t at = out.size();
+          size_t room = std::max(ZSTD_CStreamOutSize(), ZSTD_compressBound(len - in.pos));
+          out.resize(at + room);
+          ZSTD_outBuffer o = { &out[at], room, 0 };
+          remaining = ZSTD_compressStream2(_cctx, &o, &in, mode);
+          out.resize(at + o.pos);
+          if (ZSTD_isError(remaining)) throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(remaining));
+        } while (mode == ZSTD_e_continue ? in.pos < in.size : remaining != 0);
+      }
+      ZSTD_CCtx* _cctx;
+      bool _open = false;
+  };
+#endif
+
+#ifdef LOGGING_HAVE_LZ4
+  // .lz4 files (lz4 frame format, 4MB blocks), readable with lz4cat. Each rotated file is a single frame
+  class Lz4Compressor: public Compressor {
+    public:
+      explicit Lz4Compressor(int level = 0) {
+        memset(&_prefs, 0, sizeof(_prefs));
+        _prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+        _prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+        _prefs.compressionLevel = level;
+        if (LZ4F_isError(LZ4F_createCompressionContext(&_cctx, LZ4F_VERSION))) {
+          throw std::runtime_error("LZ4F_createCompressionContext failed");
+        }
+      }
+      ~Lz4Compressor() { LZ4F_freeCompressionContext(_cctx); }
+      void compress(const char* buf, size_t len, std::vector<char>& out) override {
+        if (!_open) {
+          check(LZ4F_compressBegin(_cctx, reserve(out, LZ4F_HEADER_SIZE_MAX), LZ4F_HEADER_SIZE_MAX, &_prefs), out);
+          _open = true;
+        }
+        size_t room = LZ4F_compressBound(len, &_prefs);
+        check(LZ4F_compressUpdate(_cctx, reserve(out, room), room, buf, len, nullptr), out);
+      }
+      void flush(std::vector<char>& out) override {
+        if (_open) {
+          size_t room = LZ4F_compressBound(0, &_prefs);
+          check(LZ4F_flush(_cctx, reserve(out, room), room, nullptr), out);
+        }
+      }
+      void finish(std::vector<char>& out) override {
+        if (_open) {
+          size_t room = LZ4F_compressBound(0, &_prefs);
+          check(LZ4F_compressEnd(_cctx, reserve(out, room), room, nullptr), out);
+          _open = false;
+        }
+      }
+      const char* extension() const override { return ".lz4"; }
+    private:
+      // grows out by room bytes, returning where to write; check() then trims it back to what was written
+      char* reserve(std::vector<char>& out, size_t room) {
+        _at = out.size();
+        out.resize(_at + room);
+        return &out[_at];
+      }
+      void check(size_t rc, std::vector<char>& out) {
+        if (LZ4F_isError(rc)) {
+          out.resize(_at);
+          throw std::runtime_error(std::string("lz4: ") + LZ4F_getErrorName(rc));
+        }
+        out.resize(_at + rc);
+      }
+      LZ4F_cctx* _cctx = nullptr;
+      LZ4F_preferences_t _prefs;
+      size_t _at = 0;
+      bool _open = false;
+  };
+#endif
+}
+
+#endif
@@ -0,0 +1,524 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+
+/**
+  * printf compatible formatting used by the background thread (in place of boost::format). Static formats (string
+  * literals) are parsed once & cached by address, others are parsed each time, & arguments are rendered straight into
+  * a reusable buffer, e.g.:
+  *
+  *   auto& f = LoggingHelper::Formatter::local();
+  *   f.clear();
+  *   f.begin("%s is %zd bytes\n");
+  *   f % "abc" % size_t(3);
+  *   f.end();
+  *   fwrite(f.data(), f.size(), 1, stdout);
+  *
+  * Arguments are converted as printf would given the conversion & length modifier (so %d with an unsigned
+  * prints it signed, %hhx truncates to a byte etc.). Extra arguments are ignored & conversions without an
+  * argument are output as-is. %n and %m are not supported.
+***/
+
+#ifndef LOGGING_FORMAT_DEFINE
+#define LOGGING_FORMAT_DEFINE
+
+#include <charconv>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace LoggingHelper {
+  class Formatter {
+    public:
+      enum Flags: uint8_t { LEFT = 1, PLUS = 2, SPACE = 4, ALT = 8, ZERO = 16 };
+      enum Length: uint8_t { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_BIG_L, LEN_J, LEN_Z, LEN_T };
+      struct Spec {
+        char conv = 0;           // 0 for literal text
+        uint8_t flags = 0;
+        uint8_t length = LEN_NONE;
+        bool widthStar = false;  // width/precision come from the preceding argument(s)
+        bool precisionStar = false;
+        int width = 0;
+        int precision = -1;
+      };
+      struct Item {
+        const char* text;        // literal text, or the original conversion text (output if there's no argument)
+        uint32_t len;
+        Spec spec;
+      };
+
+      static Formatter& local() { static thread_local Formatter f; return f; }
+
+      Formatter() { _buf.resize(1 << 16); _slots.resize(1024); }
+
+      void clear() { _len = 0; }
+      const char* data() const { return _buf.data(); }
+      size_t size() const { return _len; }
+
+      // HH:MM:SS.uuuuuu (with the HH:MM:SS rendered once per second)
+      void timestamp(int64_t microsSinceMidnight) {
+        int64_t secs = microsSinceMidnight / 1000000;
+        int64_t micros = microsSinceMidnight % 1000000;
+        if (secs != _stampSecs) {
+          int len = snprintf(_stamp, sizeof(_stamp), "%02d:%02d:%02d", int(secs / 60 / 60), int((secs / 60) % 60), int(secs % 60));
+          _stampLen = (len < 0 || len >= int(sizeof(_stamp))) ? 0 : len;
+          _stampSecs = secs;
+        }
+        char* p = reserve(_stampLen + 7);
+        memcpy(p, _stamp, _stampLen);
+        p += _stampLen;
+        *p++ = '.';
+        for (int i = 5; i >= 0; --i) {
+          p[i] = '0' + micros % 10;
+          micros /= 10;
+        }
+        _len += _stampLen + 7;
+      }
+      void append(const char* s, size_t len) {
+        memcpy(reserve(len), s, len);
+        _len += len;
+      }
+      void append(char c) {
+        *reserve(1) = c;
+        ++_len;
+      }
+      void append(const char* s) { append(s, strlen(s)); }
+      // (so std::back_inserter(f) can be written to, e.g. by std::vformat_to)
+      using value_type = char;
+      void push_back(char c) { append(c); }
+      void appendInt(int64_t i) {
+        char* p = reserve(24);
+        _len = std::to_chars(p, p + 24, i).ptr - _buf.data();
+      }
+
+      // start rendering a format, outputting its text up to the first conversion. Only formats that live for the life
+      // of the program (string literals) may be cached: anything else (e.g. a copy in a queue slot) must pass false
+      void begin(const char* format, bool isStatic = true) {
+        if (isStatic) {
+          const Slot& s = compile(format);
+          _item = _items.data() + s.first;
+          _itemEnd = _item + s.count;
+        } else {
+          _scratch.clear();
+          parse(format, _scratch);
+          _item = _scratch.data();
+          _itemEnd = _item + _scratch.size();
+        }
+        _haveWidth = _havePrecision = false;
+        literals();
+      }
+      // renders the next conversion with v
+      template <typename T> Formatter& operator%(const T& value) {
+        const std::decay_t<T> v = value; // e.g. string literals
+        if (_item == _itemEnd) return *this;
+        const Spec& spec = _item->spec;
+        if (spec.conv == 'n') {
+          ++_item;
+          literals();
+          return *this;
+        }
+        if (spec.widthStar && !_haveWidth) {
+          _width = asInt(v);
+          _haveWidth = true;
+          return *this;
+        }
+        if (spec.precisionStar && !_havePrecision) {
+          _precision = asInt(v);
+          _havePrecision = true;
+          return *this;
+        }
+        Spec s = spec;
+        if (s.widthStar) {
+          if (_width < 0) {
+            s.flags |= LEFT;
+            s.width = -_width;
+          } else {
+            s.width = _width;
+          }
+        }
+        if (s.precisionStar) s.precision = _precision < 0 ? -1 : _precision;
+        render(s, v);
+        _haveWidth = _havePrecision = false;
+        ++_item;
+        literals();
+        return *this;
+      }
+      // outputs whatever's left of the format (i.e., conversions we didn't get arguments for)
+      void end() {
+        while (_item != _itemEnd) {
+          append(_item->text, _item->len);
+          ++_item;
+        }
+      }
+
+      // renders a single value as the (printf) conversion s would, outside of any begin()/end()
+      template <typename T> void format(const Spec& s, const T& v) { render(s, v); }
+      // inserts n copies of c at pos, e.g. to pad something already rendered
+      void insert(size_t pos, size_t n, char c) {
+        reserve(n);
+        memmove(&_buf[pos + n], &_buf[pos], _len - pos);
+        memset(&_buf[pos], c, n);
+        _len += n;
+      }
+      void erase(size_t pos, size_t n) {
+        memmove(&_buf[pos], &_buf[pos + n], _len - pos - n);
+        _len -= n;
+      }
+
+    private:
+      struct Slot {
+        const char* format = nullptr;
+        uint32_t first = 0;
+        uint32_t count = 0;
+      };
+
+      char* reserve(size_t n) {
+        if (_len + n > _buf.size()) _buf.resize(std::max(_buf.size() * 2, _len + n));
+        return &_buf[_len];
+      }
+      void literals() {
+        while (_item != _itemEnd && _item->spec.conv == 0) {
+          append(_item->text, _item->len);
+          ++_item;
+        }
+      }
+      void pad(size_t n, char c) {
+        memset(reserve(n), c, n);
+        _len += n;
+      }
+
+      template <typename T> static int asInt(const T& v) {
+        if constexpr (std::is_integral_v<T> || std::is_enum_v<T> || std::is_floating_point_v<T>) return int(v);
+        else return 0;
+      }
+
+      template <typename T> void render(const Spec& s, const T& v) {
+        if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>) {
+          if (s.conv == 'p') renderPointer(s, v);
+          else renderString(s, v == nullptr ? "(null)" : v);
+        } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+          renderPointer(s, nullptr);
+        } else if constexpr (std::is_pointer_v<T>) {
+          renderPointer(s, (const void*)v);
+        } else if constexpr (std::is_enum_v<T>) {
+          render(s, std::underlying_type_t<T>(v));
+        } else if constexpr (std::is_integral_v<T>) {
+          switch (s.conv) {
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+              renderFloat(s, (long double)v);
+              break;
+            default:
+              renderInt(s, uint64_t(v), std::is_signed_v<T>);
+          }
+        } else if constexpr (std::is_floating_point_v<T>) {
+          switch (s.conv) {
+            case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+              renderInt(s, uint64_t(int64_t(v)), true);
+              break;
+            default:
+              renderFloat(s, v);
+          }
+        } else {
+          static_assert(std::is_pointer_v<T>, "Unsupported printf argument type");
+        }
+      }
+
+      void renderString(const Spec& s, const char* str) {
+        size_t len = s.precision >= 0 ? strnlen(str, s.precision) : strlen(str);
+        padded(s, "", 0, str, len);
+      }
+      void renderPointer(const Spec& s, const void* p) {
+        if (p == nullptr) {
+          padded(s, "", 0, "(nil)", 5);
+          return;
+        }
+        char digits[24];
+        size_t len = std::to_chars(digits, digits + sizeof(digits), uintptr_t(p), 16).ptr - digits;
+        padded(s, "0x", 2, digits, len);
+      }
+      // out = [spaces][prefix][zeroes]body[spaces]
+      void padded(const Spec& s, const char* prefix, size_t prefixLen, const char* body, size_t bodyLen, size_t zeroes = 0) {
+        size_t len = prefixLen + zeroes + bodyLen;
+        size_t fill = size_t(s.width) > len ? s.width - len : 0;
+        if (fill && !(s.flags & LEFT)) pad(fill, ' ');
+        append(prefix, prefixLen);
+        if (zeroes) pad(zeroes, '0');
+        append(body, bodyLen);
+        if (fill && (s.flags & LEFT)) pad(fill, ' ');
+      }
+
+      void renderInt(const Spec& s, uint64_t raw, bool isSigned) {
+        if (s.conv == 'c') {
+          char c = char(raw);
+          padded(s, "", 0, &c, 1);
+          return;
+        }
+        // reinterpret the bits as printf would given the length modifier & conversion (%s of a number prints it as is)
+        int bits = 32;
+        switch (s.length) {
+          case LEN_HH: bits = 8; break;
+          case LEN_H: bits = 16; break;
+          case LEN_NONE: break;
+          default: bits = 64;
+        }
+        if (s.conv == 's' || s.conv == 'p') bits = 64;
+        bool signedConv = (s.conv == 'd' || s.conv == 'i' || (s.conv == 's' && isSigned));
+        if (bits < 64) {
+          raw &= (uint64_t(1) << bits) - 1;
+          if (signedConv && ((raw >> (bits - 1)) & 1)) raw |= ~uint64_t(0) << bits; // sign extend
+        }
+        bool negative = false;
+        if (signedConv && int64_t(raw) < 0) {
+          negative = true;
+          raw = uint64_t(0) - raw;
+        }
+        int base = 10;
+        if (s.conv == 'x' || s.conv == 'X' || s.conv == 'p') base = 16;
+        else if (s.conv == 'o') base = 8;
+
+        if (s.flags == 0 && s.width == 0 && s.precision < 0) { // the common case
+          char* p = reserve(24);
+          if (negative) *p++ = '-';
+          p = std::to_chars(p, p + 23, raw, base).ptr;
+          if (s.conv == 'X') for (char* c = &_buf[_len]; c < p; ++c) if (*c >= 'a') *c -= 'a' - 'A';
+          _len = p - _buf.data();
+          return;
+        }
+        char digits[24];
+        size_t len = 0;
+        if (!(raw == 0 && s.precision == 0)) { // printf outputs no digits for a zero with precision 0
+          len = std::to_chars(digits, digits + sizeof(digits), raw, base).ptr - digits;
+          if (s.conv == 'X') for (size_t i = 0; i < len; ++i) if (digits[i] >= 'a') digits[i] -= 'a' - 'A';
+        }
+        char prefix[3];
+        size_t prefixLen = 0;
+        if (negative) prefix[prefixLen++] = '-';
+        else if (signedConv && (s.flags & PLUS)) prefix[prefixLen++] = '+';
+        else if (signedConv && (s.flags & SPACE)) prefix[prefixLen++] = ' ';
+        size_t zeroes = s.precision > int(len) ? s.precision - len : 0;
+        if ((s.flags & ALT) && raw != 0 && (s.conv == 'x' || s.conv == 'X')) {
+          prefix[prefixLen++] = '0';
+          prefix[prefixLen++] = s.conv;
+        } else if ((s.flags & ALT) && s.conv == 'o' && zeroes == 0 && (len == 0 || digits[0] != '0')) {
+          zeroes = 1;
+        }
+        if ((s.flags & ZERO) && !(s.flags & LEFT) && s.precision < 0 && size_t(s.width) > prefixLen + zeroes + len) {
+          zeroes = s.width - prefixLen - len;
+        }
+        padded(s, prefix, prefixLen, digits, len, zeroes);
+      }
+
+      template <typename F> void renderFloat(const Spec& s, F v) {
+        if (s.conv == 'a' || s.conv == 'A' || (s.flags & ALT)) {
+          renderFloatViaSnprintf(s, v);
+          return;
+        }
+        std::chars_format fmt = std::chars_format::fixed;
+        int precision = s.precision < 0 ? 6 : s.precision;
+        switch (s.conv) {
+          case 'e': case 'E': fmt = std::chars_format::scientific; break;
+          case 'g': case 'G': fmt = std::chars_format::general; if (precision == 0) precision = 1; break;
+          default: break;
+        }
+        size_t room = precision + 400 + (sizeof(F) > sizeof(double) ? 4600 : 0);
+        char* start = reserve(room + 1);
+        char* p = start;
+        if (!std::signbit(v)) {
+          if (s.flags & PLUS) *p++ = '+';
+          else if (s.flags & SPACE) *p++ = ' ';
+        }
+        auto r = std::to_chars(p, start + room, v, fmt, precision);
+        if (r.ec != std::errc()) {
+          renderFloatViaSnprintf(s, v);
+          return;
+        }
+        char* end = r.ptr;
+        bool upper = (s.conv == 'F' || s.conv == 'E' || s.conv == 'G');
+        if (upper) for (char* c = start; c < end; ++c) if (*c >= 'a' && *c <= 'z') *c -= 'a' - 'A';
+        size_t len = end - start;
+        if (size_t(s.width) <= len) {
+          _len += len;
+          return;
+        }
+        // checking the text rather than isfinite(), which -ffast-math may assume
+        size_t signLen = (*start == '-' || *start == '+' || *start == ' ') ? 1 : 0;
+        bool finite = (start[signLen] >= '0' && start[signLen] <= '9');
+        size_t fill = s.width - len;
+        if (s.flags & LEFT) {
+          _len += len;
+          pad(fill, ' ');
+        } else {
+          char c = ((s.flags & ZERO) && finite) ? '0' : ' ';
+          size_t keep = (c == '0') ? signLen : 0; // zeroes go after any sign
+          memmove(start + keep + fill, start + keep, len - keep);
+          memset(start + keep, c, fill);
+          _len += len + fill;
+        }
+      }
+      template <typename F> void renderFloatViaSnprintf(const Spec& s, F v) {
+        char fmt[32];
+        char* f = fmt;
+        *f++ = '%';
+        if (s.flags & LEFT) *f++ = '-';
+        if (s.flags & PLUS) *f++ = '+';
+        if (s.flags & SPACE) *f++ = ' ';
+        if (s.flags & ALT) *f++ = '#';
+        if (s.flags & ZERO) *f++ = '0';
+        *f++ = '*';
+        *f++ = '.';
+        *f++ = '*';
+        if (std::is_same_v<F, long double>) *f++ = 'L';
+        *f++ = s.conv;
+        *f = 0;
+        int precision = s.precision < 0 ? (s.conv == 'a' || s.conv == 'A' ? -1 : 6) : s.precision;
+        using Arg = std::conditional_t<std::is_same_v<F, long double>, long double, double>;
+        int len = snprintf(nullptr, 0, fmt, s.width, precision, Arg(v));
+        if (len < 0) return;
+        char* p = reserve(len + 1);
+        snprintf(p, len + 1, fmt, s.width, precision, Arg(v));
+        _len += len;
+      }
+
+      static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+      static int parseInt(const char*& p) {
+        int i = 0;
+        while (isDigit(*p)) i = i * 10 + (*p++ - '0');
+        return i;
+      }
+      // parses one conversion (p points just after the '%'). Returns false if we don't understand it
+      static bool parseSpec(const char*& p, Spec& s) {
+        for (;; ++p) {
+          switch (*p) {
+            case '-': s.flags |= LEFT; continue;
+            case '+': s.flags |= PLUS; continue;
+            case ' ': s.flags |= SPACE; continue;
+            case '#': s.flags |= ALT; continue;
+            case '0': s.flags |= ZERO; continue;
+            case '\'': continue; // thousands grouping: ignored (we're always in the C locale)
+          }
+          break;
+        }
+        if (*p == '*') {
+          s.widthStar = true;
+          ++p;
+        } else {
+          s.width = parseInt(p);
+        }
+        if (*p == '.') {
+          ++p;
+          if (*p == '*') {
+            s.precisionStar = true;
+            ++p;
+          } else {
+            s.precision = parseInt(p);
+          }
+        }
+        switch (*p) {
+          case 'h': ++p; if (*p == 'h') { ++p; s.length = LEN_HH; } else s.length = LEN_H; break;
+          case 'l': ++p; if (*p == 'l') { ++p; s.length = LEN_LL; } else s.length = LEN_L; break;
+          case 'q': ++p; s.length = LEN_LL; break;
+          case 'L': ++p; s.length = LEN_BIG_L; break;
+          case 'j': ++p; s.length = LEN_J; break;
+          case 'z': case 'Z': ++p; s.length = LEN_Z; break;
+          case 't': ++p; s.length = LEN_T; break;
+        }
+        switch (*p) {
+          case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c': case 's': case 'p': case 'n':
+          case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            s.conv = *p++;
+            return true;
+        }
+        return false;
+      }
+      void parse(const char* format, std::vector<Item>& items) {
+        const char* lit = format;
+        const char* p = format;
+        auto literal = [&items](const char* from, const char* to) {
+          if (to > from) items.push_back(Item{from, uint32_t(to - from), Spec()});
+        };
+        while (*p) {
+          if (*p != '%') {
+            ++p;
+            continue;
+          }
+          literal(lit, p);
+          const char* start = p++;
+          if (*p == '%') { // the second '%' starts the next literal
+            lit = p++;
+            continue;
+          }
+          Spec s;
+          if (parseSpec(p, s)) {
+            items.push_back(Item{start, uint32_t(p - start), s});
+            lit = p;
+          } else {
+            lit = start; // output as-is (e.g. %m, or a truncated format)
+            if (*p) ++p;
+          }
+        }
+        literal(lit, p);
+      }
+      const Slot& compile(const char* format) {
+        size_t mask = _slots.size() - 1;
+        size_t i = (uintptr_t(format) >> 3) * 0x9E3779B97F4A7C15ULL >> 20;
+        for (;; ++i) {
+          Slot& s = _slots[i & mask];
+          if (s.format == format) return s;
+          if (s.format == nullptr) break;
+        }
+        if (_used * 2 >= _slots.size()) { // grow (& so never more than half full)
+          std::vector<Slot> old;
+          old.swap(_slots);
+          _slots.resize(old.size() * 2);
+          for (const auto& o: old) {
+            if (o.format == nullptr) continue;
+            size_t j = (uintptr_t(o.format) >> 3) * 0x9E3779B97F4A7C15ULL >> 20;
+            while (_slots[j & (_slots.size() - 1)].format != nullptr) ++j;
+            _slots[j & (_slots.size() - 1)] = o;
+          }
+          return compile(format);
+        }
+        Slot& s = _slots[i & mask];
+        s.format = format;
+        s.first = _items.size();
+        parse(format, _items);
+        s.count = _items.size() - s.first;
+        ++_used;
+        return s;
+      }
+
+      std::vector<char> _buf;
+      size_t _len = 0;
+      std::vector<Item> _items;  // every compiled format, back to back
+      std::vector<Item> _scratch; // the current uncached format
+      std::vector<Slot> _slots;  // format address -> its items
+      size_t _used = 0;
+      const Item* _item = nullptr;
+      const Item* _itemEnd = nullptr;
+      bool _haveWidth = false, _havePrecision = false;
+      int _width = 0, _precision = 0;
+      int64_t _stampSecs = -1;
+      char _stamp[32];
+      int _stampLen = 0;
+  };
+}
+
+#endif
@@ -0,0 +1,611 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+
+/**
+  * std::format style ("{}") formats for LOG_INFO() etc. The format is checked against the argument types at
+  * compile time, the arguments are captured in binary (strings copied) & the line is only rendered on the
+  * background thread, into Formatter. Arguments may be bools, chars, integers, floats, strings (const char*,
+  * std::string, std::string_view), void* pointers & Bytes.
+  *
+  * Where the standard library has <format> (gcc 13 on), the format is checked by std::format_string & rendered by
+  * std::vformat_to, so everything std::format supports for those types works. Otherwise (or with
+  * LOGGING_NO_STD_FORMAT defined) a renderer of our own is used, which supports {} {N} &
+  * [[fill]align][sign][#][0][width][.precision][type] as std::format renders them. Not supported by it (a compile
+  * error): nested {} widths/precisions, 'L' and '?'.
+***/
+
+#ifndef LOGGING_FORMAT_STRING_DEFINE
+#define LOGGING_FORMAT_STRING_DEFINE
+
+#include "LoggingHelper.hpp"
+
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <tuple>
+#include <vector>
+
+#if !defined(LOGGING_NO_STD_FORMAT) && __has_include(<format>)
+#include <format>
+#if defined(__cpp_lib_format)
+#define LOGGING_STD_FORMAT 1
+#endif
+#endif
+
+namespace LoggingHelper {
+  struct BraceSpec {
+    char fill = ' ';
+    char align = 0;        // '<', '>', '^' or 0 for the type's default
+    char sign = 0;         // '+', ' ' or 0
+    bool alt = false;      // '#'
+    bool zero = false;     // '0'
+    int width = 0;
+    int precision = -1;
+    char type = 0;
+  };
+  struct BraceItem {
+    const char* text;      // literal text (for arg < 0)
+    uint32_t len;
+    int arg;
+    BraceSpec spec;
+  };
+
+  // one per LOG_INFO() etc. call site (a constant initialized static, so free to set up)
+  struct LogSite {
+    const char* file;
+    int line;
+    const char* format;
+    Lane lane = Lane::NORMAL;
+    mutable const std::vector<BraceItem>* parsed = nullptr; // only used by the background thread
+  };
+
+  // raw bytes, copied into the record (up to the space there is) rather than formatted on the hot thread. Rendered
+  // as hex for a {}, or after the line by LOG_HEX()
+  struct Bytes {
+    const void* data;
+    uint32_t len;          // bytes copied
+    uint32_t total;        // bytes passed
+  };
+  enum class BinaryFormat: uint8_t { NONE, HEXDUMP, BASE64 };
+
+  enum class ArgKind: uint8_t { NONE, BOOL, CHAR, INT, FLOAT, STRING, POINTER, BYTES };
+  template <typename T> constexpr ArgKind argKind() {
+    using D = std::decay_t<T>;
+    if constexpr (std::is_same_v<D, bool>) return ArgKind::BOOL;
+    else if constexpr (std::is_same_v<D, char>) return ArgKind::CHAR;
+    else if constexpr (std::is_integral_v<D>) return ArgKind::INT;
+    else if constexpr (std::is_floating_point_v<D>) return ArgKind::FLOAT;
+    else if constexpr (std::is_same_v<D, const char*> || std::is_same_v<D, char*> ||
+        std::is_same_v<D, std::string> || std::is_same_v<D, std::string_view>) return ArgKind::STRING;
+    else if constexpr (std::is_same_v<D, std::nullptr_t> || std::is_same_v<D, void*> || std::is_same_v<D, const void*>) {
+      return ArgKind::POINTER;
+    } else if constexpr (std::is_same_v<D, Bytes>) return ArgKind::BYTES;
+    else return ArgKind::NONE;
+  }
+
+  // what's copied into the queue for an argument of type T
+  template <typename T> struct Captured {
+    using type = std::conditional_t<std::is_array_v<T>, const std::remove_extent_t<T>*, std::decay_t<T>>;
+  };
+  template <> struct Captured<std::string> { using type = std::string_view; };
+  template <typename T> using CapturedT = typename Captured<std::remove_cv_t<std::remove_reference_t<T>>>::type;
+
+  // not constexpr, so reaching it while checking a format at compile time fails the build at the offending call
+  inline void formatStringError(const char* message) { }
+
+  // parses format into h.literal(from, to) & h.field(arg, spec) calls, or stops at h.error(message)
+  template <typename Handler> constexpr void parseBraceFormat(const char* p, const char* end, Handler& h) {
+    auto isDigit = [](char c) { return c >= '0' && c <= '9'; };
+    auto parseInt = [&](const char*& q) {
+      int i = 0;
+      while (q != end && isDigit(*q)) i = i * 10 + (*q++ - '0');
+      return i;
+    };
+    auto isAlign = [](char c) { return c == '<' || c == '>' || c == '^'; };
+    const char* lit = p;
+    int nextArg = 0;
+    bool automatic = false, manual = false;
+    while (p != end) {
+      if (*p == '}') {
+        if (p + 1 == end || p[1] != '}') return h.error("unmatched '}' in format string (use '}}' for a '}')");
+        h.literal(lit, p + 1);
+        p += 2;
+        lit = p;
+        continue;
+      }
+      if (*p != '{') {
+        ++p;
+        continue;
+      }
+      if (p + 1 != end && p[1] == '{') {
+        h.literal(lit, p + 1);
+        p += 2;
+        lit = p;
+        continue;
+      }
+      h.literal(lit, p);
+      ++p;
+      int arg;
+      if (p != end && isDigit(*p)) {
+        arg = parseInt(p);
+        manual = true;
+      } else {
+        arg = nextArg++;
+        automatic = true;
+      }
+      if (automatic && manual) return h.error("can't mix automatic ({}) and manual ({0}) argument indexing");
+      BraceSpec s;
+      if (p != end && *p == ':') {
+        ++p;
+        if (p + 1 < end && isAlign(p[1]) && *p != '{' && *p != '}') {
+          if (static_cast<unsigned char>(*p) >= 0x80) return h.error("only ASCII fill characters are supported");
+          s.fill = *p;
+          s.align = p[1];
+          p += 2;
+        } else if (p != end && isAlign(*p)) {
+          s.align = *p++;
+        }
+        if (p != end && (*p == '+' || *p == '-' || *p == ' ')) {
+          if (*p != '-') s.sign = *p;
+          ++p;
+        }
+        if (p != end && *p == '#') {
+          s.alt = true;
+          ++p;
+        }
+        if (p != end && *p == '0') {
+          s.zero = true;
+          ++p;
+        }
+        if (p != end && *p == '{') return h.error("dynamic ({}) widths aren't supported");
+        s.width = parseInt(p);
+        if (p != end && *p == '.') {
+          ++p;
+          if (p != end && *p == '{') return h.error("dynamic ({}) precisions aren't supported");
+          if (p == end || !isDigit(*p)) return h.error("missing precision after '.'");
+          s.precision = parseInt(p);
+        }
+        if (p != end && *p == 'L') return h.error("locale specific ('L') formatting isn't supported");
+        if (p != end && *p != '}') s.type = *p++;
+      }
+      if (p == end || *p != '}') return h.error("invalid or unterminated replacement field");
+      ++p;
+      h.field(arg, s);
+      lit = p;
+    }
+    h.literal(lit, end);
+  }
+
+  // checks a format against its argument types, at compile time
+  template <typename... Args> struct FormatChecker {
+    static constexpr ArgKind kinds[] = { argKind<Args>()..., ArgKind::NONE };
+    constexpr void literal(const char*, const char*) { }
+    constexpr void error(const char* message) { formatStringError(message); }
+    constexpr bool oneOf(char c, const char* types) {
+      for (; *types; ++types) if (c == *types) return true;
+      return false;
+    }
+    constexpr void field(int arg, const BraceSpec& s) {
+      if (arg >= int(sizeof...(Args))) return error("the format refers to more arguments than were passed");
+      bool asText = false; // i.e., no sign, '#' or '0'
+      switch (kinds[arg]) {
+        case ArgKind::BOOL:
+          if (!oneOf(s.type, "sbBcdoxX") && s.type != 0) return error("invalid type for a bool");
+          asText = (s.type == 0 || s.type == 's');
+          break;
+        case ArgKind::CHAR:
+        case ArgKind::INT:
+          if (!oneOf(s.type, "bBcdoxX") && s.type != 0) return error("invalid type for an integer/char");
+          asText = (s.type == 'c' || (s.type == 0 && kinds[arg] == ArgKind::CHAR));
+          break;
+        case ArgKind::FLOAT:
+          if (!oneOf(s.type, "aAeEfFgG") && s.type != 0) return error("invalid type for a floating point number");
+          break;
+        case ArgKind::STRING:
+          if (s.type != 0 && s.type != 's') return error("invalid type for a string");
+          asText = true;
+          break;
+        case ArgKind::POINTER:
+          if (s.type != 0 && s.type != 'p') return error("invalid type for a pointer");
+          if (s.sign || s.alt || s.zero) return error("sign, '#' and '0' aren't valid for a pointer");
+          break;
+        case ArgKind::BYTES:
+          if (s.type != 0) return error("invalid type for bytes");
+          asText = true;
+          break;
+        case ArgKind::NONE:
+          return error("argument type can't be logged with a {} format (pointers need a cast to void*)");
+      }
+      if (asText && (s.sign || s.alt || s.zero)) return error("sign, '#' and '0' aren't valid when formatting as text");
+      if (s.precision >= 0 && kinds[arg] != ArgKind::FLOAT && kinds[arg] != ArgKind::STRING) {
+        return error("precision is only valid for floating point numbers and strings");
+      }
+    }
+  };
+
+  // a format string checked against Args at compile time. Use FormatString<std::type_identity_t<Args>...> as
+  // a parameter, so the arguments determine Args
+  template <typename... Args> struct FormatString {
+    static_assert(((argKind<Args>() != ArgKind::NONE) && ...),
+        "argument type can't be logged with a {} format (pointers need a cast to void*)");
+    template <size_t N> consteval FormatString(const char (&format)[N]): _format(format) {
+#ifdef LOGGING_STD_FORMAT
+      std::format_string<const Args&...> checked(format);
+      (void)checked;
+#else
+      FormatChecker<Args...> checker;
+      parseBraceFormat(format, format + N - 1, checker);
+#endif
+    }
+    const char* _format;
+  };
+
+  // at run time
+  inline void parseBraceFormat(const char* format, std::vector<BraceItem>& items) {
+    struct Handler {
+      std::vector<BraceItem>& items;
+      bool failed = false;
+      void literal(const char* from, const char* to) {
+        if (to > from) items.push_back(BraceItem{from, uint32_t(to - from), -1, BraceSpec()});
+      }
+      void field(int arg, const BraceSpec& s) { items.push_back(BraceItem{"", 0, arg, s}); }
+      void error(const char*) { failed = true; }
+    } h{items};
+    size_t first = items.size();
+    parseBraceFormat(format, format + strlen(format), h);
+    if (h.failed) { // can't happen for a checked format, but output it as-is if it does
+      items.resize(first);
+      h.literal(format, format + strlen(format));
+    }
+  }
+
+  namespace detail {
+    inline void braceInt(Formatter& f, const BraceSpec& s, uint64_t raw, bool isSigned) {
+      bool negative = isSigned && int64_t(raw) < 0;
+      uint64_t magnitude = negative ? uint64_t(0) - raw : raw;
+      char buf[72];
+      char* p = buf;
+      if (negative) *p++ = '-';
+      else if (s.sign) *p++ = s.sign;
+      int base = 10;
+      switch (s.type) {
+        case 'b': case 'B': base = 2; break;
+        case 'o': base = 8; break;
+        case 'x': case 'X': base = 16; break;
+      }
+      if (s.alt && base != 10 && !(base == 8 && magnitude == 0)) {
+        *p++ = '0';
+        if (base != 8) *p++ = s.type;
+      }
+      char* digits = p;
+      p = std::to_chars(p, buf + sizeof(buf), magnitude, base).ptr;
+      if (s.type == 'X') for (char* c = digits; c < p; ++c) if (*c >= 'a') *c -= 'a' - 'A';
+      f.append(buf, p - buf);
+    }
+
+    // true unless what was rendered from start is inf/nan
+    inline bool braceFinite(const Formatter& f, size_t start) {
+      for (size_t i = start; i < f.size(); ++i) if (f.data()[i] == 'n' || f.data()[i] == 'N') return false;
+      return true;
+    }
+    // makes sure the number rendered from start has a decimal point (for '#'), before any exponent
+    inline void braceDecimalPoint(Formatter& f, size_t start, char exponent) {
+      if (!braceFinite(f, start)) return;
+      size_t at = f.size();
+      for (size_t i = start; i < f.size(); ++i) {
+        char c = f.data()[i];
+        if (c == '.') return;
+        if ((c | 0x20) == exponent && at == f.size()) at = i;
+      }
+      f.insert(at, 1, '.');
+    }
+
+    template <typename F> void braceFloat(Formatter& f, const BraceSpec& s, F v) {
+      Formatter::Spec ps;
+      if (s.sign == '+') ps.flags |= Formatter::PLUS;
+      else if (s.sign == ' ') ps.flags |= Formatter::SPACE;
+      ps.precision = s.precision;
+      size_t start = f.size();
+      if (s.type == 0 && s.precision < 0) { // the shortest text that reads back as v
+        char buf[128];
+        char* p = buf;
+        if (!std::signbit(v) && s.sign) *p++ = s.sign;
+        auto r = std::to_chars(p, buf + sizeof(buf), v);
+        if (r.ec == std::errc()) {
+          f.append(buf, r.ptr - buf);
+        } else {
+          ps.conv = 'g';
+          f.format(ps, v);
+        }
+        if (s.alt) braceDecimalPoint(f, start, 'e');
+      } else if (s.type == 0 || s.type == 'a' || s.type == 'A') {
+        ps.conv = s.type ? s.type : 'g'; // general, with the given precision
+        if (s.alt && ps.conv == 'g') ps.flags |= Formatter::ALT;
+        f.format(ps, v);
+        if (ps.conv != 'g') { // std::format's %a has no 0x
+          const char* d = f.data() + start;
+          size_t signLen = (*d == '-' || *d == '+' || *d == ' ') ? 1 : 0;
+          if (d[signLen] == '0' && (d[signLen + 1] == 'x' || d[signLen + 1] == 'X')) f.erase(start + signLen, 2);
+          if (s.alt) braceDecimalPoint(f, start, 'p');
+        }
+      } else { // as printf
+        ps.conv = s.type;
+        if (s.alt) ps.flags |= Formatter::ALT;
+        f.format(ps, v);
+      }
+    }
+
+    // pads what was rendered from start out to the spec's width
+    inline void braceWidth(Formatter& f, const BraceSpec& s, size_t start, bool numeric) {
+      size_t len = f.size() - start;
+      if (size_t(s.width) <= len) return;
+      size_t fill = s.width - len;
+      if (s.zero && s.align == 0 && numeric && braceFinite(f, start)) { // zeroes go after any sign & 0x/0b prefix
+        const char* d = f.data() + start;
+        size_t skip = (*d == '-' || *d == '+' || *d == ' ') ? 1 : 0;
+        if (s.alt && len >= skip + 2 && d[skip] == '0' && strchr("xXbB", d[skip + 1]) != nullptr) skip += 2;
+        f.insert(start + skip, fill, '0');
+        return;
+      }
+      char align = s.align ? s.align : (numeric ? '>' : '<');
+      size_t before = (align == '>') ? fill : (align == '^') ? fill / 2 : 0;
+      if (before) f.insert(start, before, s.fill);
+      if (fill > before) f.insert(f.size(), fill - before, s.fill);
+    }
+
+    template <typename T> void braceArg(Formatter& f, const BraceSpec& s, const void* value) {
+      const T& v = *static_cast<const T*>(value);
+      constexpr ArgKind kind = argKind<T>();
+      size_t start = f.size();
+      bool numeric = true;
+      if constexpr (kind == ArgKind::BOOL) {
+        if (s.type == 0 || s.type == 's') {
+          f.append(v ? "true" : "false");
+          numeric = false;
+        } else if (s.type == 'c') {
+          f.append(char(v));
+          numeric = false;
+        } else {
+          braceInt(f, s, uint64_t(v), false);
+        }
+      } else if constexpr (kind == ArgKind::CHAR || kind == ArgKind::INT) {
+        if (s.type == 'c' || (s.type == 0 && kind == ArgKind::CHAR)) {
+          f.append(char(v));
+          numeric = false;
+        } else {
+          braceInt(f, s, uint64_t(v), std::is_signed_v<T>);
+        }
+      } else if constexpr (kind == ArgKind::FLOAT) {
+        braceFloat(f, s, v);
+      } else if constexpr (kind == ArgKind::STRING) {
+        std::string_view sv;
+        if constexpr (std::is_pointer_v<T>) sv = (v == nullptr) ? "(null)" : v;
+        else sv = v;
+        if (s.precision >= 0 && sv.size() > size_t(s.precision)) sv = sv.substr(0, s.precision);
+        f.append(sv.data(), sv.size());
+        numeric = false;
+      } else if constexpr (kind == ArgKind::POINTER) {
+        char buf[24] = "0x";
+        char* p = std::to_chars(buf + 2, buf + sizeof(buf), uintptr_t((const void*)v), 16).ptr;
+        f.append(buf, p - buf);
+      } else if constexpr (kind == ArgKind::BYTES) {
+        static const char digits[] = "0123456789abcdef";
+        const auto* b = static_cast<const unsigned char*>(v.data);
+        for (uint32_t i = 0; i < v.len; ++i) {
+          f.append(digits[b[i] >> 4]);
+          f.append(digits[b[i] & 15]);
+        }
+        if (v.len < v.total) f.append("...");
+        numeric = false;
+      }
+      braceWidth(f, s, start, numeric);
+    }
+  }
+
+#ifdef LOGGING_STD_FORMAT
+  // renders format (already checked by FormatString) with the given arguments
+  template <typename T> const T& stdFormatArg(const T& v) { return v; }
+  inline const char* stdFormatArg(const char* v) { return v != nullptr ? v : "(null)"; } // as printf & our renderer do
+  template <typename... Values> void renderBraces(Formatter& f, const char* format, const Values&... values) {
+    std::tuple<Values...> args{ stdFormatArg(values)... }; // (make_format_args only takes lvalues)
+    std::apply([&](auto&... a) { std::vformat_to(std::back_inserter(f), format, std::make_format_args(a...)); }, args);
+  }
+#endif
+
+  // renders items (a parsed format) with the given arguments
+  template <typename... Values> void renderBraces(Formatter& f, const std::vector<BraceItem>& items, const Values&... values) {
+    using Render = void (*)(Formatter&, const BraceSpec&, const void*);
+    const void* args[] = { static_cast<const void*>(&values)..., nullptr };
+    static constexpr Render renderers[] = { &detail::braceArg<Values>..., nullptr };
+    for (const auto& item: items) {
+      if (item.arg < 0) f.append(item.text, item.len);
+      else if (item.arg < int(sizeof...(Values))) renderers[item.arg](f, item.spec, args[item.arg]);
+    }
+  }
+
+  // LOG_HEX()'s dump of b, after the line
+  inline void renderBinary(Formatter& f, BinaryFormat style, const Bytes& b) {
+    static const char hex[] = "0123456789abcdef";
+    const auto* data = static_cast<const unsigned char*>(b.data);
+    if (style == BinaryFormat::BASE64) {
+      static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+      f.append("  ");
+      for (uint32_t i = 0; i < b.len; i += 3) {
+        uint32_t n = uint32_t(data[i]) << 16;
+        if (i + 1 < b.len) n |= uint32_t(data[i + 1]) << 8;
+        if (i + 2 < b.len) n |= data[i + 2];
+        char out[4] = { alphabet[n >> 18], alphabet[(n >> 12) & 63], alphabet[(n >> 6) & 63], alphabet[n & 63] };
+        if (i + 1 >= b.len) out[2] = '=';
+        if (i + 2 >= b.len) out[3] = '=';
+        f.append(out, 4);
+      }
+      f.append('\n');
+    } else { // as hexdump -C: "  0010  00 01 02 03 04 05 06 07  08 09 0a 0b 0c 0d 0e 0f  |................|"
+      int offsetDigits = b.len > 0x10000 ? 8 : 4;
+      for (uint32_t at = 0; at < b.len; at += 16) {
+        char line[96];
+        memset(line, ' ', sizeof(line));
+        char* p = line + 2;
+        for (int shift = (offsetDigits - 1) * 4; shift >= 0; shift -= 4) *p++ = hex[(at >> shift) & 15];
+        p += 2;
+        char* ascii = p + 16 * 3 + 1 + 1;
+        *ascii++ = '|';
+        for (uint32_t i = at; i < at + 16 && i < b.len; ++i) {
+          p[0] = hex[data[i] >> 4];
+          p[1] = hex[data[i] & 15];
+          p += (i - at == 7) ? 4 : 3;
+          *ascii++ = (data[i] >= 32 && data[i] < 127) ? char(data[i]) : '.';
+        }
+        *ascii++ = '|';
+        *ascii++ = '\n';
+        f.append(line, ascii - line);
+      }
+    }
+    if (b.len < b.total) {
+      f.append("  (truncated: ");
+      f.appendInt(b.len);
+      f.append(" of ");
+      f.appendInt(b.total);
+      f.append(" bytes logged)\n");
+    }
+  }
+
+  template <> inline size_t getSingleSize<Bytes>(Bytes b) { return 2 * sizeof(uint32_t); }
+  template <>
+  inline void writeOutSingle<Bytes>(char*& stack, size_t& left, Bytes b) {
+    uint32_t len = std::min<size_t>(b.len, left);
+    memcpy(stack, &len, sizeof(len));
+    memcpy(stack + sizeof(len), &b.total, sizeof(b.total));
+    memcpy(stack + 2 * sizeof(len), b.data, len);
+    stack += 2 * sizeof(len) + len;
+    left -= len;
+  }
+
+  // reads back an argument written out by writeOut()
+  template <typename T> T readCaptured(const char*& stack) {
+    if constexpr (std::is_same_v<T, Bytes>) {
+      Bytes b;
+      memcpy(&b.len, stack, sizeof(b.len));
+      memcpy(&b.total, stack + sizeof(b.len), sizeof(b.total));
+      b.data = stack + 2 * sizeof(b.len);
+      stack += 2 * sizeof(b.len) + b.len;
+      return b;
+    } else if constexpr (argKind<T>() == ArgKind::STRING) {
+      const char* s = stack;
+      stack += strlen(s) + 1;
+      return T(const_cast<char*>(s));
+    } else {
+      T v;
+      memcpy(static_cast<void*>(&v), stack, sizeof(T));
+      stack += sizeof(T);
+      return v;
+    }
+  }
+
+  template <typename... Params> struct BracePrinterT: public Printer {
+    BracePrinterT(size_t bufSize, const LogSite* site, Params... parameters): _site(site) {
+      size_t minSize = getMinSize(parameters...);
+      char* stack = reinterpret_cast<char*>(this) + sizeof(*this);
+      _argsBegin = sizeof(*this);
+      _argsEnd = writeOut(stack, bufSize - sizeof(*this) - minSize, parameters...) - reinterpret_cast<char*>(this);
+    }
+    virtual void print() const override {
+      const char* stack = reinterpret_cast<const char*>(this) + sizeof(*this);
+      std::tuple<Params...> values{ readCaptured<Params>(stack)... }; // (braces, so read in order)
+      Formatter& fmt = Formatter::local();
+      fmt.clear();
+      printPrefix(fmt);
+#ifdef LOGGING_STD_FORMAT
+      std::apply([&](const Params&... v) { renderBraces(fmt, _site->format, v...); }, values);
+#else
+      if (_site->parsed == nullptr) {
+        auto* items = new std::vector<BraceItem>(); // kept for the life of the program, as is the site
+        parseBraceFormat(_site->format, *items);
+        _site->parsed = items;
+      }
+      std::apply([&](const Params&... v) { renderBraces(fmt, *_site->parsed, v...); }, values);
+#endif
+      if constexpr (sizeof...(Params) > 0) {
+        constexpr size_t last = sizeof...(Params) - 1;
+        if constexpr (std::is_same_v<std::tuple_element_t<last, std::tuple<Params...>>, Bytes>) {
+          if (_binary != BinaryFormat::NONE) renderBinary(fmt, _binary, std::get<last>(values));
+        }
+      }
+      Printer::write(fmt, _out, _sink, _micros);
+    }
+    virtual const char* getFormat() const override { return _site->format; }
+    const LogSite* _site;
+    BinaryFormat _binary = BinaryFormat::NONE; // if set, the last argument is dumped after the line (LOG_HEX)
+  };
+
+  template <typename Out, typename... Args>
+    inline Printer* createBracePrinter(size_t bSize, Out* out, void* buf, const std::tuple<int, int, int, int64_t>& tm,
+        const LogSite& site, const Args&... args) {
+      Printer* p = new (buf)BracePrinterT<CapturedT<Args>...>(bSize, &site, CapturedT<Args>(args)...);
+      p->setOutput(out);
+      p->setPrefix(tm, site.file, site.line);
+      return p;
+    }
+  // the line, then a dump of bytes
+  template <typename Out, typename... Args>
+    inline Printer* createBinaryPrinter(size_t bSize, Out* out, void* buf, const std::tuple<int, int, int, int64_t>& tm,
+        const LogSite& site, BinaryFormat style, const Bytes& bytes, const Args&... args) {
+      auto* p = new (buf)BracePrinterT<CapturedT<Args>..., Bytes>(bSize, &site, CapturedT<Args>(args)..., bytes);
+      p->_binary = style;
+      p->setOutput(out);
+      p->setPrefix(tm, site.file, site.line);
+      return p;
+    }
+
+  // renders the line on the calling thread (when background logging is off)
+  template <typename... Args>
+    inline Formatter& formatNow(const std::tuple<int, int, int, int64_t>& tm, const LogSite& site, const Args&... args) {
+      Formatter& fmt = Formatter::local();
+      fmt.clear();
+      Printer::printPrefix(fmt, Printer::microsSinceMidnight(tm), site.file, site.line, ThreadContexts::current());
+#ifdef LOGGING_STD_FORMAT
+      std::tuple<CapturedT<Args>...> values{ CapturedT<Args>(args)... };
+      std::apply([&](const CapturedT<Args>&... v) { renderBraces(fmt, site.format, v...); }, values);
+#else
+      static thread_local std::vector<BraceItem> items;
+      items.clear();
+      parseBraceFormat(site.format, items);
+      renderBraces(fmt, items, CapturedT<Args>(args)...);
+#endif
+      return fmt;
+    }
+}
+
+#ifdef LOGGING_STD_FORMAT
+// Bytes as hex (with "..." if they were truncated), padded & aligned as a string would be
+template <> struct std::formatter<LoggingHelper::Bytes, char>: std::formatter<std::string_view, char> {
+  template <typename FormatContext> auto format(const LoggingHelper::Bytes& b, FormatContext& ctx) const {
+    static const char digits[] = "0123456789abcdef";
+    static thread_local std::string hex;
+    hex.clear();
+    const auto* p = static_cast<const unsigned char*>(b.data);
+    for (uint32_t i = 0; i < b.len; ++i) {
+      hex += digits[p[i] >> 4];
+      hex += digits[p[i] & 15];
+    }
+    if (b.len < b.total) hex += "...";
+    return std::formatter<std::string_view, char>::format(hex, ctx);
+  }
+};
+#endif
+
+#endif
@@ -20,11 +20,19 @@
 #ifndef LOGGING_HELPER_DEFINE
 #define LOGGING_HELPER_DEFINE
 
-#include <boost/format.hpp>
-#include <sstream>
+#include "LoggingSink.hpp"
+#include "LoggingFormat.hpp"
+
+#include <tuple>
+#include <string_view>
 #include <string.h>
+#include <atomic>
+#include <mutex>
 
 namespace LoggingHelper {
+  // warnings & fatals go on their own queue, which the consumer always serves first
+  enum class Lane: uint8_t { NORMAL, HIGH };
+
   struct Util {
     // buffer 'to' must be able to hold len+1 characters. Returns size of ecrypted string
     virtual size_t encrypt(const char* from, char* to, size_t len) { 
@@ -36,7 +44,16 @@ namespace LoggingHelper {
       memcpy(to,from,len);
       return len;
     }
-    virtual void setJunkThreadAffinity(bool f = true) { // sets to last CPU
+    virtual void setJunkThreadAffinity(bool f = true) { pinToJunk(f); } // sets to last CPU
+    virtual void setThreadAffinity(int cpu) { pinTo(cpu); } // pins the calling thread to the given cpu
+    virtual std::tuple<int, int, int, int64_t> timeParts(int64_t ts=0) { return splitTime(ts); }
+    virtual int realUSleep(useconds_t usec) { return ::usleep(usec); }
+
+    // reset pointer to derived instance to replace w/ custom line encryption
+    static Util*& util() { static Util* ptr = new ::LoggingHelper::Util(); return(ptr); }
+
+    // the default implementations (shared with InlinePolicy)
+    static void pinToJunk(bool f) {
       int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
       pthread_t current_thread = pthread_self();    
       cpu_set_t cpuset;
@@ -52,7 +69,17 @@ namespace LoggingHelper {
       }
     }
 
-    virtual std::tuple<int, int, int, int64_t> timeParts(int64_t ts=0) {
+    static void pinTo(int cpu) {
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      CPU_SET(cpu, &cpuset);
+      if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset)) {
+        perror("pthread_setaffinity_np");
+      }
+    }
+
+    // hours/minutes/seconds/micros of ts (nanos since the epoch), or of now for 0
+    static std::tuple<int, int, int, int64_t> splitTime(int64_t ts) {
       timespec tp;
       if (ts==0) {
         clock_gettime(CLOCK_REALTIME, &tp);
@@ -67,13 +94,60 @@ namespace LoggingHelper {
           (secsSinceMidnight / 60) % 60,
           (secsSinceMidnight % 60),
           tp.tv_nsec / 1000);
-
     }
-    virtual int realUSleep(useconds_t usec) { return ::usleep(usec); }
+  };
 
-    // reset pointer to derived instance to replace w/ custom line encryption
-    static Util*& util() { static Util* ptr = new ::LoggingHelper::Util(); return(ptr); }
+  // Everything the logger needs from its environment goes through Policy, chosen at compile time by defining
+  // LOGGING_POLICY (the same in every translation unit, e.g. -DLOGGING_POLICY=::LoggingHelper::InlinePolicy). A policy
+  // is any type with these static functions. The default forwards to the Util singleton, so stays overridable at
+  // run time (e.g. for tests & backtests)
+  struct UtilPolicy {
+    static std::tuple<int, int, int, int64_t> timeParts() { return Util::util()->timeParts(); }
+    static size_t encrypt(const char* from, char* to, size_t len) { return Util::util()->encrypt(from, to, len); }
+    static int realUSleep(useconds_t usec) { return Util::util()->realUSleep(usec); }
+    static void setJunkThreadAffinity() { Util::util()->setJunkThreadAffinity(); }
+    static void setThreadAffinity(int cpu) { Util::util()->setThreadAffinity(cpu); }
+  };
+  // Util's defaults, inlined (no pointer load or virtual call per line)
+  struct InlinePolicy {
+    static std::tuple<int, int, int, int64_t> timeParts() { return Util::splitTime(0); }
+    static size_t encrypt(const char* from, char* to, size_t len) {
+      memcpy(to, from, len);
+      return len;
+    }
+    static int realUSleep(useconds_t usec) { return ::usleep(usec); }
+    static void setJunkThreadAffinity() { Util::pinToJunk(true); }
+    static void setThreadAffinity(int cpu) { Util::pinTo(cpu); }
+  };
+  // for backtests built with it (Logging::Config::backtest): timestamps from the simulated clock & no sleeping, inlined
+  struct SimulatedPolicy {
+    static std::tuple<int, int, int, int64_t> timeParts() {
+      return Util::splitTime(std::max<int64_t>(SimulatedClock::nanos().load(std::memory_order_relaxed), 1)); // (0 is now)
+    }
+    static size_t encrypt(const char* from, char* to, size_t len) { return InlinePolicy::encrypt(from, to, len); }
+    static int realUSleep(useconds_t) { return 0; }
+    static void setJunkThreadAffinity() { }
+    static void setThreadAffinity(int) { }
+  };
+  // what Logging::init() installs for a backtest under UtilPolicy: the simulated clock & no sleeping, with encryption &
+  // affinity still going to the Util it replaces
+  struct SimulatedUtil: public Util {
+    explicit SimulatedUtil(Util* real): _real(real) { }
+    size_t encrypt(const char* from, char* to, size_t len) override { return _real->encrypt(from, to, len); }
+    size_t decrypt(const char* from, char* to, size_t len) override { return _real->decrypt(from, to, len); }
+    void setJunkThreadAffinity(bool f = true) override { _real->setJunkThreadAffinity(f); }
+    void setThreadAffinity(int cpu) override { _real->setThreadAffinity(cpu); }
+    std::tuple<int, int, int, int64_t> timeParts(int64_t ts=0) override {
+      return ts == 0 ? SimulatedPolicy::timeParts() : splitTime(ts);
+    }
+    int realUSleep(useconds_t) override { return 0; }
+    Util* _real;
   };
+#ifndef LOGGING_POLICY
+#define LOGGING_POLICY ::LoggingHelper::UtilPolicy
+#endif
+  using Policy = LOGGING_POLICY;
+
   inline void CheckFormat(int) { }
   
   // some template magic to determine the minimum space our parameter pack will take when we
@@ -85,6 +159,7 @@ namespace LoggingHelper {
   }
   template <> inline size_t getSingleSize<const char*>(const char* c) { return 1; }
   template <> inline size_t getSingleSize<char*>(char* c) { return 1; }
+  template <> inline size_t getSingleSize<std::string_view>(std::string_view c) { return 1; }
 
   inline size_t getMinSize() { return 0; }
   template <typename C, typename ... Types>
@@ -100,6 +175,7 @@ namespace LoggingHelper {
   }
   template <>
   inline void writeOutSingle<const char*>(char*& stack, size_t& left, const char* c) {
+    if (c == NULL) c = "(null)";
     do {
       if (left==0 || *c == 0) {
         *stack=0;
@@ -117,87 +193,273 @@ namespace LoggingHelper {
   inline void writeOutSingle<char*>(char*& stack, size_t& left, char* c) {
     writeOutSingle<const char*>(stack, left, c);
   }
+  // written out like a C string (so read back as one), truncated at any embedded NUL
+  template <>
+  inline void writeOutSingle<std::string_view>(char*& stack, size_t& left, std::string_view c) {
+    size_t len = std::min(left, c.size());
+    memcpy(stack, c.data(), len);
+    stack[len] = 0;
+    len = strnlen(stack, len);
+    stack += len + 1;
+    left -= len;
+  }
 
-  inline void writeOut(char* stack, size_t left) { }
+  // returns the end of what was written
+  inline char* writeOut(char* stack, size_t left) { return stack; }
   template <typename C, typename ... Types>
-  static inline void writeOut(char* stack, size_t left, C c, Types... rest) { 
+  static inline char* writeOut(char* stack, size_t left, C c, Types... rest) { 
     writeOutSingle(stack, left, c); // updates stack and left
-    writeOut(stack, left, rest...);
+    return writeOut(stack, left, rest...);
   }
 
 
+  // Strings from Logging::setThreadContext(), by id (0 is none), for the background thread to expand into line prefixes.
+  // Never freed, so they're read without locking
+  struct ThreadContexts {
+    static constexpr size_t CAPACITY = 4096;
+    static ThreadContexts& contexts() { static ThreadContexts* ptr = new ThreadContexts(); return *ptr; } // outlives main
+    // the calling thread's context id, carried by each line it logs
+    static uint16_t& current() {
+      static thread_local uint16_t id = 0;
+      return id;
+    }
+    // registers context (or finds it, if it already has been) & returns its id
+    uint16_t id(std::string_view context) {
+      if (context.empty()) return 0;
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (uint16_t i = 1; i < _count; ++i) {
+        if (*_names[i].load(std::memory_order_relaxed) == context) return i;
+      }
+      if (_count == CAPACITY) throw std::runtime_error("Too many logging thread contexts");
+      _names[_count].store(new std::string(context), std::memory_order_release);
+      return _count++;
+    }
+    const std::string* name(uint16_t id) const {
+      return id < CAPACITY ? _names[id].load(std::memory_order_acquire) : nullptr;
+    }
+    private:
+    std::mutex _mutex;
+    std::atomic<const std::string*> _names[CAPACITY] = {};
+    uint16_t _count = 1;
+  };
+
   struct Printer {
     virtual void print() const = 0;
-    template <size_t bSize, class C, typename... Params>
-      static void createPrinter(FILE* out, void* buf, C fmt, Params... parameters);
+    // constructs a printer for the given format & arguments in the bSize bytes at buf
+    template <class C, typename... Params>
+      static Printer* createPrinter(size_t bSize, FILE* out, void* buf, C fmt, Params... parameters);
+    template <class C, typename... Params>
+      static Printer* createPrinter(size_t bSize, Sink* out, void* buf, C fmt, Params... parameters);
+    template <size_t bSize, class Out, class C, typename... Params>
+      static Printer* createPrinter(Out* out, void* buf, C fmt, Params... parameters) {
+        return createPrinter(bSize, out, buf, fmt, parameters...);
+      }
+    // the same for a format that may not outlive the call (e.g. built at run time): it's copied into the record too
+    template <class Out, typename... Params>
+      static Printer* createCopyingPrinter(size_t bSize, Out* out, void* buf, const char* fmt, Params... parameters);
     FILE* _out = NULL;
+    Sink* _sink = NULL; // takes precedence over _out if set
+    // lines from INFO() etc. are prefixed with "HH:MM:SS.uuuuuu file:line " rendered from these
+    int64_t _micros = -1; // since midnight, or -1 for no prefix
+    const char* _file = NULL; // __FILE__ (the directory is stripped by the background thread)
+    int _line = 0;
+    // where the written out arguments are, relative to this
+    uint32_t _argsBegin = 0;
+    uint32_t _argsEnd = 0;
+    uint16_t _context = 0; // the logging thread's ThreadContexts id
+    std::string_view arguments() const {
+      return std::string_view(reinterpret_cast<const char*>(this) + _argsBegin, _argsEnd - _argsBegin);
+    }
+    static int64_t microsSinceMidnight(const std::tuple<int, int, int, int64_t>& tm) {
+      return ((std::get<0>(tm) * 60LL + std::get<1>(tm)) * 60 + std::get<2>(tm)) * 1000000 + std::get<3>(tm);
+    }
+    void setPrefix(const std::tuple<int, int, int, int64_t>& tm, const char* file, int line) {
+      _micros = microsSinceMidnight(tm);
+      _file = file;
+      _line = line;
+      _context = ThreadContexts::current();
+    }
+    void setOutput(FILE* out) { _out = out; }
+    void setOutput(Sink* sink) { _sink = sink; }
+    // writes out the rendered line (encrypted if ZZ_ENCRYPT_FILES is set), logged at micros (since midnight, or -1)
+    static void write(const Formatter& fmt, FILE* out, Sink* sink, int64_t micros) {
+      static bool encryption = (getenv("ZZ_ENCRYPT_FILES") != nullptr);
+      if (encryption) {
+        static std::vector<char> buf;
+        if (buf.size() < fmt.size()+2) buf.resize(fmt.size()+2);
+        size_t esz = Policy::encrypt(fmt.data(), &buf[0], fmt.size());
+        output(out, sink, &buf[0], esz, micros);
+      } else {
+        output(out, sink, fmt.data(), fmt.size(), micros);
+      }
+    }
     template <typename... Types> struct doPrint;
-    template <typename C> static void doPrintDetail(boost::format& fmt, const char*& stack) {
+    template <typename C> static void doPrintDetail(Formatter& fmt, const char*& stack) {
       const auto* c = reinterpret_cast<const C*>(stack);
       fmt % *c;
       stack += sizeof(C);
     }
     virtual const char* getFormat() const { return ""; }
+    void printPrefix(Formatter& fmt) const { printPrefix(fmt, _micros, _file, _line, _context); }
+    // "HH:MM:SS.uuuuuu file:line " (then "[context] " if there is one)
+    static void printPrefix(Formatter& fmt, int64_t micros, const char* file, int line, uint16_t context) {
+      if (micros < 0) return;
+      fmt.timestamp(micros);
+      fmt.append(' ');
+      const char* name = file;
+      for (const char* c = file; *c; ++c) if (*c == '/') name = c + 1;
+      fmt.append(name);
+      fmt.append(':');
+      fmt.appendInt(line);
+      fmt.append(' ');
+      if (context != 0) {
+        if (const std::string* c = ThreadContexts::contexts().name(context)) {
+          fmt.append('[');
+          fmt.append(c->data(), c->size());
+          fmt.append("] ");
+        }
+      }
+    }
   };
-  template <> inline void Printer::doPrintDetail<const char*>(boost::format& fmt, const char*& stack) {
+  template <> inline void Printer::doPrintDetail<const char*>(Formatter& fmt, const char*& stack) {
     const char* c = reinterpret_cast<const char*>(stack);
     fmt % c;
     while (*stack != 0) ++stack;
     ++stack;
   }
-  template <> inline void Printer::doPrintDetail<char*>(boost::format& fmt, const char*& stack) {
+  template <> inline void Printer::doPrintDetail<char*>(Formatter& fmt, const char*& stack) {
     doPrintDetail<const char*>(fmt, stack);
   }
   template <typename C, typename ...Types> struct Printer::doPrint<C, Types...> {
-    inline void operator()(boost::format&fmt, const char* stack, FILE* out) {
+    inline void operator()(Formatter& fmt, const char* stack) {
       Printer::doPrintDetail<C>(fmt, stack);
-      Printer::doPrint<Types...>().operator()(fmt, stack, out);
+      Printer::doPrint<Types...>().operator()(fmt, stack);
     }
   };
   template <> struct Printer::doPrint<> {
-    inline void operator()(boost::format& fmt, const char* stack, FILE* out) {
-      static bool encryption = (getenv("ZZ_ENCRYPT_FILES") != nullptr);
-      std::stringstream ss;
-      ss << fmt;
-      const std::string& s = ss.str();
-      if (encryption) {
-        static std::vector<char> buf;
-        if (buf.size() < s.size()+2) buf.resize(s.size()+2);
-        auto& lc = *(::LoggingHelper::Util::util());
-        size_t esz = lc.encrypt(s.c_str(), &buf[0], s.size());
-        fwrite(&buf[0], esz, 1, out);
-      } else {
-        fwrite(s.c_str(), s.size(), 1, out);
-      }
+    inline void operator()(Formatter& fmt, const char* stack) {
+      fmt.end();
     }
   };
 
-  template <size_t bufSize, typename... Params> struct PrinterT: public Printer {
-    PrinterT(FILE* out, const char* format, Params... parameters) : _format(format) {
+  template <typename... Params> struct PrinterT: public Printer {
+    // with copyFormat, the format's copied in ahead of the arguments (truncated to what the slot holds)
+    PrinterT(size_t bufSize, FILE* out, const char* format, bool copyFormat, Params... parameters) : _format(format) {
       char* buf = reinterpret_cast<char*>(this);
       _out = out;
       size_t minSize = getMinSize(parameters...);
-      char* stack = ((char*)buf) + sizeof(*this);
-      writeOut(stack, bufSize - sizeof(*this) - minSize, parameters...);
+      size_t left = bufSize - sizeof(*this) - minSize;
+      _argsBegin = sizeof(*this);
+      if (copyFormat) {
+        size_t len = strnlen(format, left - 1);
+        memcpy(buf + _argsBegin, format, len);
+        buf[_argsBegin + len] = 0;
+        _format = buf + _argsBegin;
+        _copiedFormat = true;
+        _argsBegin += len + 1;
+        left -= len + 1;
+      }
+      _argsEnd = writeOut(buf + _argsBegin, left, parameters...) - buf;
     }
     virtual void print() const override {
-      const char* stack = ((const char*)this) + sizeof(*this);
-      boost::format fmt(_format);
-      doPrint<Params...>()(fmt, stack, _out);
+      const char* stack = ((const char*)this) + _argsBegin;
+      Formatter& fmt = Formatter::local();
+      fmt.clear();
+      printPrefix(fmt);
+      fmt.begin(_format, !_copiedFormat);
+      doPrint<Params...>()(fmt, stack);
+      Printer::write(fmt, _out, _sink, _micros);
     }
     const char* _format = NULL;
+    bool _copiedFormat = false; // (so it's parsed each time, rather than cached by its address)
     virtual const char* getFormat() const override { return _format; }
   };
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wformat-security"
-  template <size_t bSize, class C, typename... Params>
-    inline void Printer::createPrinter(FILE* out, void* buf, C fmt, Params... parameters) {
-      char mybuf[1024 * 16];
-      snprintf(mybuf, sizeof(mybuf), fmt, parameters...);
-      new (buf)PrinterT<bSize, const char*>(out, "%s", mybuf);
+  template <class C, typename... Params>
+    inline Printer* Printer::createPrinter(size_t bSize, FILE* out, void* buf, C fmt, Params... parameters) {
+      return new (buf)PrinterT<Params...>(bSize, out, fmt, false, parameters...);
+    }
+  template <class Out, typename... Params>
+    inline Printer* Printer::createCopyingPrinter(size_t bSize, Out* out, void* buf, const char* fmt, Params... parameters) {
+      Printer* p = new (buf)PrinterT<Params...>(bSize, (FILE*)NULL, fmt, true, parameters...);
+      p->setOutput(out);
+      return p;
     }
-#pragma GCC diagnostic pop
+  template <class C, typename... Params>
+    inline Printer* Printer::createPrinter(size_t bSize, Sink* out, void* buf, C fmt, Params... parameters) {
+      Printer* p = createPrinter(bSize, (FILE*)NULL, buf, fmt, parameters...);
+      p->_sink = out;
+      return p;
+    }
+
+  // Collapses runs of identical lines (the same format, file:line & output, with the same argument bytes) into the
+  // first line & a "last message repeated N times (first..last)" line. Only lines with a timestamp prefix are collapsed.
+  // Used by whichever thread is writing out (so needs no locking of its own)
+  struct RepeatFilter {
+    // false if p repeats the line before it (so shouldn't be written). Otherwise writes out the count of any repeats first
+    bool pass(const Printer* p) {
+      if (p->_micros < 0) { // (but still ends a run)
+        report();
+        _format = nullptr;
+        return true;
+      }
+      std::string_view args = p->arguments();
+      uint64_t h = hash(args.data(), args.size());
+      if (h == _hash && p->getFormat() == _format && p->_file == _file && p->_line == _line && p->_out == _out &&
+          p->_sink == _sink && p->_context == _context) {
+        if (_count++ == 0) _firstMicros = p->_micros;
+        _lastMicros = p->_micros;
+        return false;
+      }
+      report();
+      _hash = h;
+      _format = p->getFormat();
+      _file = p->_file;
+      _line = p->_line;
+      _out = p->_out;
+      _sink = p->_sink;
+      _context = p->_context;
+      return true;
+    }
+    bool pending() const { return _count != 0; }
+    // writes out the number of repeats so far, if any (a continuing run is then counted afresh)
+    void report() {
+      if (_count == 0) return;
+      Formatter& fmt = Formatter::local();
+      fmt.clear();
+      Printer::printPrefix(fmt, _lastMicros, _file, _line, _context);
+      fmt.append("last message repeated ");
+      fmt.appendInt(_count);
+      fmt.append(_count == 1 ? " time (" : " times (");
+      fmt.timestamp(_firstMicros);
+      fmt.append("..");
+      fmt.timestamp(_lastMicros);
+      fmt.append(")\n");
+      Printer::write(fmt, _out, _sink, _lastMicros);
+      _count = 0;
+    }
+    // FNV-1a, a word at a time
+    static uint64_t hash(const char* p, size_t len) {
+      uint64_t h = 14695981039346656037ULL;
+      for (; len >= sizeof(uint64_t); p += sizeof(uint64_t), len -= sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        h = (h ^ w) * 1099511628211ULL;
+      }
+      for (; len > 0; ++p, --len) h = (h ^ uint8_t(*p)) * 1099511628211ULL;
+      return h;
+    }
+    uint64_t _hash = 0;
+    const char* _format = nullptr;
+    const char* _file = nullptr;
+    int _line = 0;
+    FILE* _out = nullptr;
+    Sink* _sink = nullptr;
+    uint16_t _context = 0;
+    int64_t _count = 0; // repeats not yet reported
+    int64_t _firstMicros = 0;
+    int64_t _lastMicros = 0;
+  };
 }
 
 
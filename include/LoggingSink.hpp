@@ -0,0 +1,475 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+
+/** Output sinks owned by the background logging thread (used by Logging.h) **/
+
+#ifndef LOGGING_SINK_DEFINE
+#define LOGGING_SINK_DEFINE
+
+#include "LoggingClock.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdexcept>
+#include <algorithm>
+
+namespace LoggingHelper {
+  // Everything but the constructor is only ever called from the background logging thread
+  struct Sink {
+    virtual ~Sink() { }
+    virtual void write(const char* buf, size_t len) = 0;
+    // a line logged at micros (UTC since midnight, as in its prefix), or -1 if it has no prefix
+    virtual void writeLine(const char* buf, size_t len, int64_t micros) { write(buf, len); }
+    virtual void flush() { }
+    // makes everything flushed so far durable (e.g. fsync), for Logging::flushUntil()
+    virtual void sync() { }
+    // called whenever the background thread goes idle (after flush()), e.g. for time based rotation
+    virtual void tick() { }
+  };
+
+  // Optional stage between formatting and the file write (see LoggingCompress.hpp). Each rotated file is a complete
+  // stream (e.g. a gzip member or zstd frame), so it's readable with the standard tools. Each file gets its own
+  struct Compressor {
+    virtual ~Compressor() { }
+    // appends compressed output for buf to out (often nothing until the compressor has buffered a large block)
+    virtual void compress(const char* buf, size_t len, std::vector<char>& out) = 0;
+    // appends whatever's needed to make everything compressed so far decodable by a reader of the file
+    virtual void flush(std::vector<char>& out) = 0;
+    // ends the stream (at rotation or close). The next compress() starts a new one
+    virtual void finish(std::vector<char>& out) = 0;
+    virtual const char* extension() const = 0;
+  };
+
+  struct NullSink: public Sink {
+    void write(const char* buf, size_t len) override { }
+  };
+
+  // <file>.idx (see RotatingFileConfig::indexMillis) is an array of these, in the order the lines were written. Each
+  // covers the lines from its offset to the next entry's (or the end of the file). Lines from different lanes &
+  // producers are written a little out of time order, so a bucket's times aren't all after the previous bucket's:
+  // a reader should use minMicros/maxMicros, not micros, to decide whether a bucket could hold a given time
+  struct IndexEntry {
+    int64_t micros;    // since the epoch (UTC), when the line at offset was logged
+    uint64_t offset;   // of the start of a line in the (uncompressed) file
+    int64_t minMicros; // the earliest & latest times of the bucket's lines (the last entry's may still widen, as
+    int64_t maxMicros; // it's rewritten in place until the next one starts)
+    // the epoch time of a line logged at microsSinceMidnight, assuming it was logged within the last 12 hours
+    static int64_t epochMicros(int64_t microsSinceMidnight) {
+      constexpr int64_t DAY = 24LL * 60 * 60 * 1000 * 1000;
+      int64_t now = SimulatedClock::realtimeNanos() / 1000;
+      int64_t ret = now / DAY * DAY + microsSinceMidnight;
+      return (ret > now + DAY / 2) ? ret - DAY : ret; // (logged just before midnight)
+    }
+  };
+
+  struct RotatingFileConfig {
+    std::string path;              // files are written as <path>.0, <path>.1, ... (with the compressor's extension)
+    size_t maxBytes = 1ULL << 30;  // rotate before a line would take the file past this size (0 for never)
+    int64_t maxSeconds = 0;        // rotate on multiples of this many seconds since the epoch, e.g. 3600 rotates on the hour (0 for never)
+    size_t preallocateBytes = 0;   // extents to reserve in each file ahead of time (0 means maxBytes)
+    size_t bufferBytes = 1 << 16;  // bytes held in memory between write() calls to the file
+    bool fsyncOnClose = false;     // fsync a rotated out file before closing it (done off the logging thread)
+    // makes a compressor for each file (e.g. makeCompressor<GzipCompressor>()), which compresses bufferBytes at a
+    // time (so make that large) & is flushed when the background thread goes idle. maxBytes is then checked against
+    // compressed bytes written so far, so is approximate
+    std::function<std::unique_ptr<Compressor>()> compressor;
+    // if set, each file gets a sparse <file>.idx of IndexEntry's (timestamps to offsets, for tools like logseek) with an
+    // entry at least every indexMillis of log time & every indexBytes of file. Not for compressed files
+    int64_t indexMillis = 0;
+    size_t indexBytes = 1 << 20;
+  };
+
+  // A file that rotates by size and/or time. The next file is opened & has its extents reserved with fallocate()
+  // by a helper thread well before it's needed, and rotated out files are truncated/fsynced/closed by the same
+  // helper, so the drain path only ever swaps a file descriptor.
+  class RotatingFileSink: public Sink {
+    public:
+      explicit RotatingFileSink(const RotatingFileConfig& config): _config(config) {
+        if (_config.path.empty()) throw std::runtime_error("RotatingFileSink needs a path");
+        if (_config.preallocateBytes == 0) _config.preallocateBytes = _config.maxBytes;
+        if (_config.indexMillis > 0 && _config.compressor) {
+          throw std::invalid_argument("RotatingFileSink can't index compressed files");
+        }
+        _buf.reserve(_config.bufferBytes);
+        if (_config.compressor) {
+          _compressor = _config.compressor();
+          if (!_compressor) throw std::invalid_argument("RotatingFileConfig::compressor made no compressor");
+          _extension = _compressor->extension();
+        }
+        struct stat st;
+        while (::stat(fileName(_nextSeq).c_str(), &st) == 0) ++_nextSeq; // never clobber a previous run
+        _currentSeq = _nextSeq++;
+        _fd = openFile(_currentSeq);
+        _period = currentPeriod();
+        _helper = std::thread([this]() { helperLoop(); });
+      }
+      ~RotatingFileSink() {
+        drainBuffer();
+        finishCompressor();
+        endIndex();
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          if (_indexFd >= 0) _toClose.push_back({_indexFd, _indexWritten});
+          _toClose.push_back({_fd, _written});
+          _fd = -1;
+          _exit = true;
+        }
+        _cv.notify_one();
+        _helper.join();
+      }
+      void write(const char* buf, size_t len) override { writeLine(buf, len, -1); }
+      void writeLine(const char* buf, size_t len, int64_t micros) override {
+        if (_config.maxSeconds > 0 && currentPeriod() != _period) {
+          rotate();
+        } else if (_config.maxBytes > 0 && _written > 0 && _written + _buf.size() + len > _config.maxBytes) {
+          rotate();
+        }
+        if (micros >= 0 && _config.indexMillis > 0) index(micros);
+        if (_buf.size() + len > _config.bufferBytes) {
+          drainBuffer();
+          if (len > _config.bufferBytes) {
+            writeOut(buf, len);
+            return;
+          }
+        }
+        _buf.insert(_buf.end(), buf, buf + len);
+      }
+      void flush() override {
+        drainBuffer();
+        if (_compressor && _compressorDirty) {
+          _compressor->flush(_zbuf);
+          writeCompressed();
+          _compressorDirty = false;
+        }
+        writeIndex();
+      }
+      void sync() override {
+        if (_fd >= 0) ::fdatasync(_fd);
+        if (_indexFd >= 0) ::fdatasync(_indexFd);
+      }
+      void tick() override {
+        if (_config.maxSeconds > 0 && currentPeriod() != _period) rotate();
+      }
+      const std::string& path() const { return _config.path; }
+      std::string fileName(int64_t seq) const {
+        return _config.path + "." + std::to_string(seq) + _extension;
+      }
+      // sequence number of the file currently being written
+      int64_t currentSeq() const { return _currentSeq; }
+
+    private:
+      void drainBuffer() {
+        if (!_buf.empty()) {
+          writeOut(&_buf[0], _buf.size());
+          _buf.clear();
+        }
+      }
+      void index(int64_t micros) {
+        int64_t t = IndexEntry::epochMicros(micros);
+        uint64_t offset = _written + _buf.size();
+        if (_indexed && t < _open.micros + _config.indexMillis * 1000 && offset < _open.offset + _config.indexBytes) {
+          _open.minMicros = std::min(_open.minMicros, t);
+          _open.maxMicros = std::max(_open.maxMicros, t);
+          _openDirty = true;
+          return;
+        }
+        if (_indexed) _index.push_back(_open);
+        _open = { t, offset, t, t };
+        _indexed = true;
+        _openDirty = true;
+      }
+      // the current file's last bucket is complete (at rotation or close)
+      void endIndex() {
+        if (_indexed) _index.push_back(_open);
+        _indexed = false;
+        _openDirty = false;
+        writeIndex();
+      }
+      // (after the data it points into, so a reader never finds an entry past the end of the file). Complete entries
+      // are appended, & the open one is (re)written after them
+      void writeIndex() {
+        if (_index.empty() && !_openDirty) return;
+        if (_indexFd < 0) {
+          const std::string name = fileName(_currentSeq) + ".idx";
+          _indexFd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+          if (_indexFd < 0) {
+            static int whingeCount = 0;
+            if (++whingeCount < 100) perror(("open " + name).c_str());
+            _index.clear();
+            return;
+          }
+        }
+        auto writeAt = [this](const void* from, size_t len, size_t at) {
+          const char* buf = static_cast<const char*>(from);
+          while (len > 0) {
+            ssize_t w = ::pwrite(_indexFd, buf, len, at);
+            if (w < 0) {
+              if (errno == EINTR) continue;
+              return false;
+            }
+            buf += w;
+            len -= w;
+            at += w;
+          }
+          return true;
+        };
+        if (writeAt(_index.data(), _index.size() * sizeof(IndexEntry), _indexWritten)) {
+          _indexWritten += _index.size() * sizeof(IndexEntry);
+        }
+        _index.clear();
+        if (_openDirty) writeAt(&_open, sizeof(_open), _indexWritten); // (not counted in _indexWritten until complete)
+        _openDirty = false;
+      }
+      void writeOut(const char* buf, size_t len) {
+        if (_compressor) {
+          _compressor->compress(buf, len, _zbuf);
+          writeCompressed();
+          _compressorDirty = true;
+        } else {
+          writeFully(buf, len);
+        }
+      }
+      void finishCompressor() {
+        if (_compressor) {
+          _compressor->finish(_zbuf);
+          writeCompressed();
+          _compressorDirty = false;
+        }
+      }
+      void writeCompressed() {
+        if (!_zbuf.empty()) writeFully(&_zbuf[0], _zbuf.size());
+        _zbuf.clear();
+      }
+      void writeFully(const char* buf, size_t len) {
+        while (len > 0) {
+          ssize_t w = ::write(_fd, buf, len);
+          if (w < 0) {
+            if (errno == EINTR) continue;
+            static int whingeCount = 0;
+            if (++whingeCount < 100) perror(("write to " + fileName(_currentSeq)).c_str());
+            return;
+          }
+          buf += w;
+          len -= w;
+          _written += w;
+        }
+      }
+      int64_t currentPeriod() const {
+        if (_config.maxSeconds <= 0) return 0;
+        return SimulatedClock::realtimeNanos() / (1000 * 1000 * 1000) / _config.maxSeconds;
+      }
+      int openFile(int64_t seq) {
+        const std::string name = fileName(seq);
+        int fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+          perror(("open " + name).c_str());
+          throw std::runtime_error("RotatingFileSink could not open " + name);
+        }
+        if (_config.preallocateBytes > 0) {
+          // KEEP_SIZE reserves the extents without moving EOF, so readers never see a tail of zeroes
+          if (::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, _config.preallocateBytes) != 0 && errno != EOPNOTSUPP) {
+            perror(("fallocate " + name).c_str());
+          }
+        }
+        return fd;
+      }
+      void rotate() {
+        drainBuffer();
+        finishCompressor();
+        endIndex();
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_indexFd >= 0) _toClose.push_back({_indexFd, _indexWritten});
+        _indexFd = -1;
+        _indexWritten = 0;
+        _toClose.push_back({_fd, _written});
+        _readyCv.wait(lock, [this]() { return !_preparing; }); // it's already mid-open, so that's the quickest way
+        if (_nextFd < 0) { // the helper couldn't open a file (& is backing off), so try here
+          _currentSeq = _nextSeq++;
+          lock.unlock();
+          _fd = openFile(_currentSeq);
+          if (_config.compressor) _compressor = _config.compressor();
+          lock.lock();
+        } else {
+          _fd = _nextFd;
+          _currentSeq = _nextFdSeq;
+          _nextFd = -1;
+          _compressor = std::move(_nextCompressor);
+        }
+        _written = 0;
+        _period = currentPeriod();
+        lock.unlock();
+        _cv.notify_one();
+      }
+      void helperLoop() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+          _cv.wait(lock, [this]() { return _exit || !_toClose.empty() || _nextFd < 0; });
+          while (!_toClose.empty()) {
+            auto closing = _toClose.front();
+            _toClose.erase(_toClose.begin());
+            lock.unlock();
+            // give back the preallocated extents we didn't use
+            if (::ftruncate(closing.first, closing.second) != 0) perror("ftruncate");
+            if (_config.fsyncOnClose) ::fsync(closing.first);
+            ::close(closing.first);
+            lock.lock();
+          }
+          if (_exit) break;
+          if (_nextFd < 0) {
+            int64_t seq = _nextSeq++;
+            _preparing = true;
+            lock.unlock();
+            int fd = -1;
+            std::unique_ptr<Compressor> compressor;
+            try {
+              if (_config.compressor) compressor = _config.compressor();
+              fd = openFile(seq);
+            } catch (const std::exception&) { }
+            lock.lock();
+            _nextFd = fd;
+            _nextCompressor = std::move(compressor);
+            _nextFdSeq = seq;
+            _preparing = false;
+            _readyCv.notify_one();
+            if (fd < 0) {
+              lock.unlock();
+              usleep(1000 * 1000); // don't spin on e.g. a full disk; the drain path will open inline meanwhile
+              lock.lock();
+            }
+          }
+        }
+        if (_nextFd >= 0) { // never used, so don't leave an empty file behind
+          ::close(_nextFd);
+          ::unlink(fileName(_nextFdSeq).c_str());
+          _nextFd = -1;
+        }
+      }
+
+      RotatingFileConfig _config;
+      std::vector<char> _buf;
+      std::vector<char> _zbuf;
+      std::unique_ptr<Compressor> _compressor; // the current file's
+      std::string _extension;                  // (the compressor's, fixed for the life of the sink)
+      bool _compressorDirty = false;
+      int _fd = -1;
+      int64_t _currentSeq = 0;
+      size_t _written = 0;
+      int64_t _period = 0;
+      std::vector<IndexEntry> _index; // complete entries not yet written to _indexFd
+      IndexEntry _open = { 0, 0, 0, 0 }; // the bucket lines are currently going into
+      bool _indexed = false;          // anything's been indexed in the current file (so _open is valid)
+      bool _openDirty = false;        // _open has changed since it was last written
+      int _indexFd = -1;
+      size_t _indexWritten = 0;
+
+      std::mutex _mutex; // guards everything below (shared with the helper thread)
+      std::condition_variable _cv;      // wakes the helper
+      std::condition_variable _readyCv; // wakes the drain path if it had to wait for the helper
+      bool _preparing = false;
+      int64_t _nextSeq = 0;
+      int _nextFd = -1;
+      int64_t _nextFdSeq = 0;
+      std::unique_ptr<Compressor> _nextCompressor; // for _nextFd
+      std::vector<std::pair<int, size_t> > _toClose;
+      bool _exit = false;
+      std::thread _helper;
+  };
+
+  // Sinks are created by user threads, but once created only written/flushed/destroyed by the background thread
+  struct SinkRegistry {
+    Sink* add(const std::string& name, Sink* sink) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (auto& e: _sinks) {
+        if (e.first == name) throw std::runtime_error("Logging sink '" + name + "' already exists");
+      }
+      _sinks.emplace_back(name, std::unique_ptr<Sink>(sink));
+      return sink;
+    }
+    Sink* find(const std::string& name) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (auto& e: _sinks) {
+        if (e.first == name) return e.second.get();
+      }
+      return nullptr;
+    }
+    void flushAll() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (auto& e: _sinks) {
+        e.second->flush();
+        e.second->tick();
+      }
+    }
+    void syncAll() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (auto& e: _sinks) e.second->sync();
+    }
+    void closeAll() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (auto& r: _redirects) r.second = nullptr;
+      _sinks.clear();
+    }
+    // send anything the background thread would have written to 'f' (e.g. stdout for INFO) to 'sink' instead
+    void redirect(FILE* f, Sink* sink) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (auto& r: _redirects) {
+        if (r.first == f || r.first == nullptr) {
+          r.first = f;
+          r.second = sink;
+          return;
+        }
+      }
+      throw std::runtime_error("Too many redirected logging FILE*s");
+    }
+    // lock free: only the background thread reads this, & redirects are expected to be set up before logging
+    Sink* redirected(FILE* f) const {
+      for (auto& r: _redirects) {
+        if (r.first == f) return r.second;
+        if (r.first == nullptr) break;
+      }
+      return nullptr;
+    }
+    static SinkRegistry& registry() { static SinkRegistry* ptr = new SinkRegistry(); return *ptr; } // outlives main
+    private:
+    std::mutex _mutex;
+    std::vector<std::pair<std::string, std::unique_ptr<Sink> > > _sinks;
+    std::pair<FILE*, Sink*> _redirects[8] = {};
+  };
+
+  inline void output(FILE* out, Sink* sink, const char* buf, size_t len, int64_t micros = -1) {
+    if (sink == nullptr) sink = SinkRegistry::registry().redirected(out);
+    if (sink != nullptr) {
+      sink->writeLine(buf, len, micros);
+    } else {
+      fwrite(buf, len, 1, out);
+    }
+  }
+}
+
+#endif
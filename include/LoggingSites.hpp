@@ -0,0 +1,188 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+
+/** Run time on/off switches for each logging macro call site (used by Logging.h & logctl) **/
+
+#ifndef LOGGING_SITES_DEFINE
+#define LOGGING_SITES_DEFINE
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <stdexcept>
+
+namespace LoggingHelper {
+  // A byte per macro call site (INFO(), LOG_INFO() etc.), which the site checks before doing anything else. Sites
+  // register the first time they run. The table starts out in process memory, & is moved to a /dev/shm file by
+  // attach() (Logging::Config::siteControl), so the logctl tool can list the sites & switch them on & off
+  class SiteTable {
+    public:
+      static constexpr uint32_t CAPACITY = 16384; // sites past this share a slot that's always on
+      static constexpr char MAGIC[8] = "LOGSITE";
+      struct Entry {
+        int32_t line;
+        char file[60];    // (without the directory)
+        char format[192]; // (truncated)
+      };
+      struct Layout {
+        struct alignas(64) Header {
+          char magic[8];
+          uint32_t capacity;
+          std::atomic<uint32_t> count; // entries filled in (each before this is bumped)
+          int32_t pid;
+        } header;
+        std::atomic<uint8_t> off[CAPACITY + 1]; // zero (on) to start with
+        Entry entries[CAPACITY];
+      };
+
+      // (from the macros, via a static initializer so once per site) returns the site's slot
+      static uint32_t add(const char* file, int line, const char* format) {
+        std::lock_guard<std::mutex> lock(mutex());
+        Layout* l = _current.load(std::memory_order_relaxed);
+        uint32_t slot = l->header.count.load(std::memory_order_relaxed);
+        if (slot == CAPACITY) return CAPACITY;
+        Entry& e = l->entries[slot];
+        e.line = line;
+        const char* name = file;
+        for (const char* c = file; *c; ++c) if (*c == '/') name = c + 1;
+        copy(e.file, sizeof(e.file), name);
+        copy(e.format, sizeof(e.format), format);
+        l->header.count.store(slot + 1, std::memory_order_release);
+        return slot;
+      }
+      static bool on(uint32_t slot) {
+        return _current.load(std::memory_order_relaxed)->off[slot].load(std::memory_order_relaxed) == 0;
+      }
+
+      // turns the sites matching 'site' ("*", a file name or file:line) in l on or off. Returns how many matched
+      static size_t set(Layout* l, const std::string& site, bool on) {
+        size_t colon = site.rfind(':');
+        std::string file = (colon == std::string::npos) ? site : site.substr(0, colon);
+        int line = (colon == std::string::npos) ? -1 : atoi(site.c_str() + colon + 1);
+        size_t n = 0;
+        uint32_t count = std::min(l->header.count.load(std::memory_order_acquire), CAPACITY);
+        for (uint32_t i = 0; i < count; ++i) {
+          const Entry& e = l->entries[i];
+          if (site != "*" && (file != e.file || (line >= 0 && line != e.line))) continue;
+          l->off[i].store(on ? 0 : 1, std::memory_order_relaxed);
+          ++n;
+        }
+        return n;
+      }
+      static size_t set(const std::string& site, bool on) { return set(_current.load(), site, on); }
+
+      // moves the table (& everything registered so far) into the /dev/shm file 'name', removed again at exit. A
+      // table left there by a process that's gone is replaced, but one whose process is still running is not
+      static void attach(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex());
+        if (_current.load() != &_local) throw std::runtime_error("Logging site table is already attached");
+        std::string shmName = shm(name);
+        int fd = shm_open(shmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 && errno == EEXIST) {
+          pid_t owner = ownerOf(shmName);
+          if (owner != 0) {
+            throw std::runtime_error("Logging site table " + shmName + " is in use" +
+                (owner > 0 ? " by process " + std::to_string(owner) : " (or isn't one: remove it if not)"));
+          }
+          shm_unlink(shmName.c_str());
+          fd = shm_open(shmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        }
+        if (fd < 0 || ftruncate(fd, sizeof(Layout)) != 0) {
+          if (fd >= 0) ::close(fd);
+          throw std::runtime_error("Could not create logging site table " + shmName + ": " + strerror(errno));
+        }
+        Layout* l = map(fd, shmName, PROT_READ | PROT_WRITE);
+        const Layout& from = _local;
+        uint32_t count = from.header.count.load();
+        for (uint32_t i = 0; i <= CAPACITY; ++i) l->off[i].store(from.off[i].load());
+        memcpy(l->entries, from.entries, sizeof(Entry) * count);
+        l->header.count.store(count);
+        l->header.capacity = CAPACITY;
+        l->header.pid = getpid();
+        memcpy(l->header.magic, MAGIC, sizeof(MAGIC)); // (last, so logctl won't use a half made table)
+        _current.store(l, std::memory_order_release);
+        static std::string unlinkName;
+        unlinkName = shmName;
+        atexit([]() { shm_unlink(unlinkName.c_str()); });
+      }
+      // (logctl) maps another process's table
+      static Layout* open(const std::string& name) {
+        std::string shmName = shm(name);
+        int fd = shm_open(shmName.c_str(), O_RDWR, 0);
+        if (fd < 0) throw std::runtime_error("Could not open logging site table " + shmName + ": " + strerror(errno));
+        Layout* l = map(fd, shmName, PROT_READ | PROT_WRITE);
+        if (memcmp(l->header.magic, MAGIC, sizeof(MAGIC)) != 0 || l->header.capacity != CAPACITY) {
+          munmap(l, sizeof(Layout));
+          throw std::runtime_error(shmName + " isn't a logging site table (or is from another version)");
+        }
+        return l;
+      }
+
+    private:
+      // maps (& closes) fd, checking first that it's big enough, as touching past its end would be a SIGBUS
+      static Layout* map(int fd, const std::string& shmName, int prot) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Layout)) {
+          ::close(fd);
+          throw std::runtime_error(shmName + " isn't a logging site table (or is from another version)");
+        }
+        void* p = mmap(nullptr, sizeof(Layout), prot, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) throw std::runtime_error("Could not map logging site table " + shmName);
+        return static_cast<Layout*>(p);
+      }
+      // (attach) the pid of the running process an existing table belongs to, 0 if that process has gone, or -1 if
+      // it can't be told (e.g. the table's still being made, or isn't one)
+      static pid_t ownerOf(const std::string& shmName) {
+        int fd = shm_open(shmName.c_str(), O_RDONLY, 0);
+        if (fd < 0) return (errno == ENOENT) ? 0 : -1;
+        Layout* l = nullptr;
+        try {
+          l = map(fd, shmName, PROT_READ);
+        } catch (const std::exception&) {
+          return -1;
+        }
+        pid_t pid = (memcmp(l->header.magic, MAGIC, sizeof(MAGIC)) == 0) ? l->header.pid : -1;
+        munmap(l, sizeof(Layout));
+        if (pid > 0 && kill(pid, 0) != 0 && errno == ESRCH) return 0;
+        return pid;
+      }
+      static std::string shm(const std::string& name) {
+        if (name.empty()) throw std::invalid_argument("Logging site table needs a name");
+        return (name[0] == '/') ? name : "/" + name;
+      }
+      static void copy(char* to, size_t size, const char* from) {
+        size_t len = strnlen(from, size - 1);
+        memcpy(to, from, len);
+        to[len] = 0;
+      }
+      static std::mutex& mutex() { static std::mutex m; return m; }
+      inline static Layout _local; // (zero initialized, so costs nothing until used)
+      inline static std::atomic<Layout*> _current = &_local;
+  };
+}
+
+#endif
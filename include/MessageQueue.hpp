@@ -29,6 +29,9 @@
 #include <string.h>
 #include <cstdint>
 #include <atomic>
+#include <memory>
+#include <new>
+#include <sys/mman.h>
 
 class MessageQueueTest;
 namespace Salvo {
@@ -278,6 +281,286 @@ namespace Salvo {
       return LockedMessageQueueWriteHandle(this);
     }
 
+  // As MessageQueue, but with the capacity (a power of two) & the bytes available in each slot chosen at run time.
+  // Each slot holds a PAYLOAD followed by (slotSize - sizeof(PAYLOAD)) bytes the writer may also use, e.g.
+  // RuntimeMessageQueue<char> for raw byte slots. Storage is either mmap'd (& optionally prefaulted) by the
+  // constructor, or supplied by the caller (e.g. shared memory) & either initialized (CREATE) or checked against
+  // what's expected (ATTACH, see confirmHeader()).
+  template <class PAYLOAD>
+    class RuntimeMessageQueue {
+#if __cplusplus > 199711L && __GNUG__ && __GNUC__ >= 5
+      static_assert(std::is_trivially_copyable<PAYLOAD>::value, "PAYLOAD must be memcpyable");
+#endif
+      public:
+      enum Storage { CREATE, ATTACH };
+      RuntimeMessageQueue(size_t capacity, size_t slotSize = sizeof(PAYLOAD), bool prefault = true);
+      // storage must hold storageSize(capacity, slotSize) bytes, be 64 byte aligned & outlive the queue
+      RuntimeMessageQueue(void* storage, Storage mode, size_t capacity, size_t slotSize = sizeof(PAYLOAD),
+          const std::string &overrideName_ = "");
+      ~RuntimeMessageQueue();
+      typedef RuntimeMessageQueue type;
+      typedef PAYLOAD value_type;
+      size_t capacity() const { return _capacity; }
+      size_t slotSize() const { return _slotSize; }
+      private: struct MessageQueueWriteHandle; struct MessageQueueReadHandle; struct LockedMessageQueueWriteHandle;
+      public:
+               // as MessageQueue, except the locked handle locks the slot itself (so writes in place, as nextWriteSlot())
+               struct LockedMessageQueueWriteHandle nextWriteSlotLocked();
+               struct MessageQueueWriteHandle nextWriteSlot();
+               // the read handle will increment readcount on going out of scope if there was data, unless abandon() is called.
+               // it will return a value compatible with nullptr/NULL/false if there is nothing to read.
+               struct MessageQueueReadHandle recv(std::atomic<int64_t>& readcount) const;
+               int64_t writeCount() const { return(_header->_onElement); }
+
+               // compatibility methods
+               void push_back(const PAYLOAD& val) { auto f = nextWriteSlot(); (*f) = val; }
+               void push_back_locked(const PAYLOAD& val) { auto f = nextWriteSlotLocked(); (*f) = val; }
+
+               // throws if the storage wasn't set up for this type, capacity & slot size
+               void confirmHeader(const std::string &overrideName_ = "") const;
+
+               // bytes needed for the given capacity & slot size
+               static size_t storageSize(size_t capacity, size_t slotSize = sizeof(PAYLOAD)) {
+                 return sizeof(MessageQueueHeader) + capacity * stride(slotSize);
+               }
+      private:
+               struct NODE {
+                 uint32_t _lapCount;
+                 PAYLOAD* data() { return reinterpret_cast<PAYLOAD*>(reinterpret_cast<char*>(this) + dataOffset()); }
+                 const PAYLOAD* data() const { return reinterpret_cast<const PAYLOAD*>(reinterpret_cast<const char*>(this) + dataOffset()); }
+               };
+               static _MQCONSTEXPR size_t align() { return alignof(PAYLOAD) > alignof(NODE) ? alignof(PAYLOAD) : alignof(NODE); }
+               static _MQCONSTEXPR size_t dataOffset() { return (sizeof(uint32_t) + alignof(PAYLOAD) - 1) / alignof(PAYLOAD) * alignof(PAYLOAD); }
+               static size_t stride(size_t slotSize) { return (dataOffset() + slotSize + align() - 1) / align() * align(); }
+               struct alignas(64) MessageQueueHeader {
+                 char _typeCheck[1024];
+                 size_t _lengthCheck;
+                 size_t _capacity;
+                 size_t _slotSize;
+                 alignas(64) std::atomic<int64_t> _onElement;
+               };
+               NODE* node(int64_t i) { return reinterpret_cast<NODE*>(_nodes + (i & _mask) * _stride); }
+               const NODE* node(int64_t i) const { return reinterpret_cast<const NODE*>(_nodes + (i & _mask) * _stride); }
+               void init(void* storage, bool create, const std::string &overrideName_);
+               void expectedHeader(MessageQueueHeader& h, const std::string &overrideName_ = "") const;
+
+               MessageQueueHeader* _header;
+               char* _nodes;
+               size_t _capacity;
+               size_t _mask;
+               size_t _slotSize;
+               size_t _stride;
+               size_t _storageSize;
+               bool _owned;
+
+               struct LockedMessageQueueWriteHandle {
+                 LockedMessageQueueWriteHandle(RuntimeMessageQueue* mq): _mq(mq) {
+                   // as MessageQueue: a special lapCount value marks the slot as locked (readers wait for it to go up by 1)
+                   int64_t startSpinTime = 0;
+                   do {
+                     _onElement = _mq->_header->_onElement.load(std::memory_order_acquire);
+                     _oldValue = uint32_t(_onElement / _mq->_capacity);
+                     uint32_t sentinalValue = _oldValue + std::numeric_limits<uint32_t>::max()/2;
+                     if (__sync_bool_compare_and_swap(&_mq->node(_onElement)->_lapCount, _oldValue, sentinalValue)) {
+                       break;
+                     } else if (startSpinTime==0) {
+                       startSpinTime = MQNanos();
+                     } else if (MQNanos() - startSpinTime > 1000LL * 1000 * 1000) { // spun more than 1 second!
+                       fprintf(stderr, "!!WARNING!! Spinlock error! Spun more than 1 second (trying to lock %ld (count %ld, old val %d)). Breaking lock!\n",
+                           int64_t(_onElement & _mq->_mask), _onElement, _oldValue);
+                       break;
+                     }
+                   } while (1);
+                 }
+                 int64_t MQNanos() {
+                   timespec tp;
+                   clock_gettime(CLOCK_REALTIME, &tp);
+                   return int64_t(tp.tv_sec)*1000*1000*1000 + int64_t(tp.tv_nsec);
+                 }
+                 PAYLOAD& operator* () { return *(_mq->node(_onElement)->data()); }
+                 PAYLOAD* operator-> () { return _mq->node(_onElement)->data(); }
+                 void abandon() { // unlocks the slot, unused
+                   if (_mq != NULL) __atomic_store_n(&_mq->node(_onElement)->_lapCount, _oldValue, __ATOMIC_RELEASE);
+                   _mq = NULL;
+                 }
+                 ~LockedMessageQueueWriteHandle() {
+                   if (_mq != NULL) {
+                     __atomic_store_n(&_mq->node(_onElement)->_lapCount, uint32_t(1 + _onElement / _mq->_capacity), __ATOMIC_RELEASE);
+                     _mq->_header->_onElement.store(_onElement + 1, std::memory_order_release);
+                   }
+                 }
+                 LockedMessageQueueWriteHandle(const LockedMessageQueueWriteHandle& other):
+                   _mq(other._mq), _onElement(other._onElement), _oldValue(other._oldValue) {
+                   (const_cast<LockedMessageQueueWriteHandle&>(other))._mq = NULL;
+                 }
+                 LockedMessageQueueWriteHandle& operator=(const LockedMessageQueueWriteHandle& other) = delete;
+                 private:
+                 type* _mq;
+                 int64_t _onElement;
+                 uint32_t _oldValue;
+               };
+               struct MessageQueueWriteHandle {
+                 MessageQueueWriteHandle(RuntimeMessageQueue* mq): _mq(mq) { }
+                 int64_t MQNanos() {
+                   timespec tp;
+                   clock_gettime(CLOCK_REALTIME, &tp);
+                   return int64_t(tp.tv_sec)*1000*1000*1000 + int64_t(tp.tv_nsec);
+                 }
+                 PAYLOAD& operator* () { return *(_mq->node(_mq->_header->_onElement)->data()); }
+                 PAYLOAD* operator-> () { return _mq->node(_mq->_header->_onElement)->data(); }
+                 void abandon() { _mq = NULL; }
+                 ~MessageQueueWriteHandle() {
+                   if (_mq != NULL) {
+                     int64_t onElement = _mq->_header->_onElement;
+                     __atomic_store_n(&_mq->node(onElement)->_lapCount, uint32_t(1 + onElement / _mq->_capacity), __ATOMIC_RELEASE);
+                     ++_mq->_header->_onElement;
+                   }
+                 }
+                 MessageQueueWriteHandle(const MessageQueueWriteHandle& other): _mq(other._mq) {
+                   (const_cast<MessageQueueWriteHandle&>(other))._mq = NULL;
+                 }
+                 MessageQueueWriteHandle& operator=(const MessageQueueWriteHandle& other) {
+                   if (this != &other) {
+                     _mq = other._mq;
+                     other._mq = NULL;
+                   }
+                   return *this;
+                 }
+                 private: type* _mq;
+               };
+               struct MessageQueueReadHandle {
+                 MessageQueueReadHandle(const RuntimeMessageQueue* mq, std::atomic<int64_t>& readcount): _mq(mq), _ready(false), _readcount(&readcount) {
+                   _ready = (__atomic_load_n(&mq->node(*_readcount)->_lapCount, __ATOMIC_ACQUIRE) == uint32_t(1 + readcount / mq->_capacity));
+                 }
+                 const PAYLOAD& operator* () { return _ready ? *(_mq->node(*_readcount)->data()) : *((PAYLOAD*)NULL); }
+                 const PAYLOAD* operator-> () { return _ready ? _mq->node(*_readcount)->data() : ((PAYLOAD*)NULL); }
+                 bool operator==(std::nullptr_t) { return !_ready; }
+                 bool operator!=(std::nullptr_t) { return _ready; }
+                 explicit operator bool() { return _ready; }
+                 bool operator!() const { return !_ready; }
+                 void abandon() { _mq = NULL; }
+                 ~MessageQueueReadHandle() {
+                   if (_ready && _mq != NULL) { ++*_readcount; }
+                 }
+                 MessageQueueReadHandle(const MessageQueueReadHandle& other): _mq(other._mq), _ready(other._ready), _readcount(other._readcount) {
+                   (const_cast<MessageQueueReadHandle&>(other))._ready = false;
+                   (const_cast<MessageQueueReadHandle&>(other))._mq = NULL;
+                   (const_cast<MessageQueueReadHandle&>(other))._readcount = NULL;
+                 }
+                 MessageQueueReadHandle& operator=(const MessageQueueReadHandle& other) {
+                   if (this != &other) {
+                     _mq = other._mq;
+                     _ready = other._ready;
+                     _readcount = other._readcount;
+                     (const_cast<MessageQueueReadHandle&>(other))._ready = false;
+                     (const_cast<MessageQueueReadHandle&>(other))._mq = NULL;
+                     (const_cast<MessageQueueReadHandle&>(other))._readcount = NULL;
+                   }
+                   return *this;
+                 }
+                 private:
+                 const type* _mq;
+                 bool _ready;
+                 std::atomic<int64_t>* _readcount;
+               };
+               friend class ::MessageQueueTest;
+               RuntimeMessageQueue(const RuntimeMessageQueue&) = delete;
+               RuntimeMessageQueue& operator=(const RuntimeMessageQueue&) = delete;
+    };
+
+  template <class PAYLOAD>
+    RuntimeMessageQueue<PAYLOAD>::RuntimeMessageQueue(size_t capacity, size_t slotSize, bool prefault):
+      _capacity(capacity), _mask(capacity - 1), _slotSize(slotSize), _stride(stride(slotSize)),
+      _storageSize(storageSize(capacity, slotSize)), _owned(true)
+    {
+      if (capacity == 0 || (capacity & (capacity - 1)) != 0) throw std::invalid_argument("capacity must be a power of two");
+      if (slotSize < sizeof(PAYLOAD)) throw std::invalid_argument("slotSize must be at least sizeof(PAYLOAD)");
+      void* mem = mmap(NULL, _storageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | (prefault ? MAP_POPULATE : 0), -1, 0);
+      if (mem == MAP_FAILED) throw std::bad_alloc();
+      if (prefault) { // MAP_POPULATE is only a hint; make sure every page is really there & writable
+        long pageSize = sysconf(_SC_PAGESIZE);
+        for (size_t i = 0; i < _storageSize; i += pageSize) reinterpret_cast<volatile char*>(mem)[i] = 0;
+      }
+      init(mem, false, ""); // (anonymous pages are zeroed, so every _lapCount is already 0)
+    }
+  template <class PAYLOAD>
+    RuntimeMessageQueue<PAYLOAD>::RuntimeMessageQueue(void* storage, Storage mode, size_t capacity, size_t slotSize,
+        const std::string &overrideName_):
+      _capacity(capacity), _mask(capacity - 1), _slotSize(slotSize), _stride(stride(slotSize)),
+      _storageSize(storageSize(capacity, slotSize)), _owned(false)
+    {
+      if (capacity == 0 || (capacity & (capacity - 1)) != 0) throw std::invalid_argument("capacity must be a power of two");
+      if (slotSize < sizeof(PAYLOAD)) throw std::invalid_argument("slotSize must be at least sizeof(PAYLOAD)");
+      if (reinterpret_cast<uintptr_t>(storage) % alignof(MessageQueueHeader) != 0) {
+        throw std::invalid_argument("queue storage must be 64 byte aligned");
+      }
+      init(storage, mode == CREATE, overrideName_);
+      if (mode == ATTACH) confirmHeader(overrideName_);
+    }
+  template <class PAYLOAD>
+    void RuntimeMessageQueue<PAYLOAD>::init(void* storage, bool create, const std::string &overrideName_) {
+      _header = reinterpret_cast<MessageQueueHeader*>(storage);
+      _nodes = reinterpret_cast<char*>(storage) + sizeof(MessageQueueHeader);
+      if (create || _owned) {
+        _header = new (storage) MessageQueueHeader();
+        expectedHeader(*_header, overrideName_);
+        _header->_onElement = 0;
+        if (create) for (size_t i = 0; i < _capacity; ++i) node(i)->_lapCount = 0;
+      }
+    }
+  template <class PAYLOAD>
+    RuntimeMessageQueue<PAYLOAD>::~RuntimeMessageQueue() {
+      if (_owned) munmap(_header, _storageSize);
+    }
+  template <class PAYLOAD>
+    inline void RuntimeMessageQueue<PAYLOAD>::expectedHeader(MessageQueueHeader& header, const std::string &overrideName_) const {
+      memset(header._typeCheck, 0, sizeof(header._typeCheck));
+      header._lengthCheck = _storageSize;
+      header._capacity = _capacity;
+      header._slotSize = _slotSize;
+      if (overrideName_.empty()) {
+        int status = 0;
+        char* realname = abi::__cxa_demangle(typeid(*this).name(), 0, 0, &status);
+        if (realname == NULL) {
+          snprintf(header._typeCheck, sizeof(header._typeCheck), "%s", typeid(*this).name());
+        } else {
+          snprintf(header._typeCheck, sizeof(header._typeCheck), "%s", realname);
+          free(realname);
+        }
+      } else {
+        snprintf(header._typeCheck, sizeof(header._typeCheck), "RuntimeMessageQueue<%s>", overrideName_.c_str());
+      }
+    }
+  template <class PAYLOAD>
+    inline void RuntimeMessageQueue<PAYLOAD>::confirmHeader(const std::string &overrideName_) const {
+      MessageQueueHeader* header = new MessageQueueHeader(); // (too big for comfort on the stack)
+      std::unique_ptr<MessageQueueHeader> cleanup(header);
+      expectedHeader(*header, overrideName_);
+      if (strncmp(header->_typeCheck, _header->_typeCheck, sizeof(header->_typeCheck))!=0) {
+        fprintf(stderr, "Type mismatch: %s vs %.1024s\n", header->_typeCheck, _header->_typeCheck);
+        throw std::runtime_error("type mismatch of queue");
+      }
+      if (header->_lengthCheck != _header->_lengthCheck || header->_capacity != _header->_capacity ||
+          header->_slotSize != _header->_slotSize) {
+        fprintf(stderr, "Message queue size doesn't match that in segment: %ld bytes (%ld x %ld) vs %ld bytes (%ld x %ld)\n",
+            header->_lengthCheck, header->_capacity, header->_slotSize,
+            _header->_lengthCheck, _header->_capacity, _header->_slotSize);
+        throw std::runtime_error("message queue length mismatch");
+      }
+    }
+  template <class PAYLOAD>
+    typename RuntimeMessageQueue<PAYLOAD>::MessageQueueReadHandle RuntimeMessageQueue<PAYLOAD>::recv(std::atomic<int64_t>& readcount) const {
+      return MessageQueueReadHandle(this, readcount);
+    }
+  template <class PAYLOAD>
+    typename RuntimeMessageQueue<PAYLOAD>::MessageQueueWriteHandle RuntimeMessageQueue<PAYLOAD>::nextWriteSlot() {
+      return MessageQueueWriteHandle(this);
+    }
+  template <class PAYLOAD>
+    typename RuntimeMessageQueue<PAYLOAD>::LockedMessageQueueWriteHandle RuntimeMessageQueue<PAYLOAD>::nextWriteSlotLocked() {
+      return LockedMessageQueueWriteHandle(this);
+    }
+
 } // namespace Salvo
 #endif
 
@@ -16,7 +16,7 @@
 ***/
 
 #include "../include/Logging.hpp"
-detail::LoggingBackgroundThread* detail::LoggingBackgroundThread::_instance = NULL;
+std::atomic<detail::LoggingBackgroundThread*> detail::LoggingBackgroundThread::_instance = NULL;
 struct LoggingBackgroundThreadDeleter {
   static inline void myterminate() {
     static int64_t justExit = 0;
@@ -66,8 +66,7 @@ struct LoggingBackgroundThreadDeleter {
   }
   ~LoggingBackgroundThreadDeleter() { 
     Logging::sync();
-    delete(detail::LoggingBackgroundThread::_instance);
-    detail::LoggingBackgroundThread::_instance = NULL;
+    delete(detail::LoggingBackgroundThread::_instance.exchange(NULL));
   }
 } _loggingBackgroundThreadDeleter;
 
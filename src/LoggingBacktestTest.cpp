@@ -0,0 +1,74 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+#include "LoggingTestSink.hpp"
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#include <boost/test/included/unit_test.hpp>
+
+constexpr int64_t SECOND = 1000LL * 1000 * 1000;
+constexpr int64_t DAY_START = 1700006400LL * SECOND; // (a UTC midnight)
+
+// a few seconds of a simulated day, a step per millisecond
+static void replay() {
+  for (int64_t ms = 0; ms < 3000; ++ms) {
+    Logging::step(DAY_START + (9 * 3600 + 30 * 60) * SECOND + ms * 1000 * 1000 + 250 * 1000);
+    if (ms % 500 == 0) INFO("tick %ld", ms);
+    if (ms >= 1000) LOG_INFO("feed {} is down", "XHKG"); // (collapsed, & counted each simulated second)
+    if (ms == 2999) {
+      for (int i = 0; i < 100; ++i) LOG_INFO("burst {}", i); // more than the queue holds
+    }
+  }
+  Logging::step(DAY_START + 10 * 3600 * SECOND);
+  Logging::sync();
+}
+
+BOOST_AUTO_TEST_CASE( LoggingBacktestTest )
+{
+  Logging::Config config;
+  config.backtest = true;
+  config.suppressRepeats = true;
+  auto* sink = initPollLogger(config);
+  Logging::yieldViaSleep() = true; // (which a backtest ignores: it never sleeps)
+
+  Logging::step(DAY_START + 9 * 3600 * SECOND);
+  INFO("at %s", "nine");
+  BOOST_CHECK(sink->_s.empty()); // nothing's written until the step ends
+  BOOST_CHECK(Logging::step(DAY_START + 9 * 3600 * SECOND + 1500) == 1);
+  BOOST_CHECK(sink->_s.find("09:00:00.000000 LoggingBacktestTest.cpp:") == 0);
+  BOOST_CHECK(Logging::poll() == 0);
+  LOG_WARN("at {}", "nine & a bit");
+  BOOST_CHECK(Logging::step(DAY_START + 9 * 3600 * SECOND + 3000) == 1);
+  BOOST_CHECK(sink->_s.find("09:00:00.000001 LoggingBacktestTest.cpp:") != std::string::npos);
+
+  // the same replay writes the same bytes, however long it took, & doesn't wait on the logger
+  sink->_s.clear();
+  int64_t start = detail::LoggingBackgroundThread::monotonicNanos();
+  replay();
+  std::string first = sink->_s;
+  sink->_s.clear();
+  replay();
+  BOOST_CHECK(detail::LoggingBackgroundThread::monotonicNanos() - start < 2 * SECOND);
+  BOOST_CHECK(first == sink->_s);
+  BOOST_CHECK(first.find("09:30:00.000250 LoggingBacktestTest.cpp:") == 0);
+  BOOST_CHECK(first.find(" tick 2500\n") != std::string::npos);
+  BOOST_CHECK(first.find(" burst 99\n") != std::string::npos);
+  size_t at = first.find("09:30:01.000250 LoggingBacktestTest.cpp:");
+  BOOST_REQUIRE(at != std::string::npos);
+  BOOST_CHECK(first.find(" feed XHKG is down\n", at) != std::string::npos);
+  BOOST_CHECK(first.find(" last message repeated 499 times (") != std::string::npos);
+}
@@ -0,0 +1,50 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+#include "LoggingTestSink.hpp"
+#include <thread>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#include <boost/test/included/unit_test.hpp>
+
+BOOST_AUTO_TEST_CASE( LoggingContextTest )
+{
+  auto* sink = initPollLogger();
+  uint16_t id = Logging::setThreadContext("strategy-A");
+  BOOST_CHECK(id != 0);
+  BOOST_CHECK(Logging::setThreadContext(std::string("strategy-A")) == id); // registered once
+  INFO("order %d sent", 1);
+  LOG_INFO("order {} sent", 2);
+  std::thread([]() {
+    Logging::setThreadContext("strategy-B");
+    INFO("order %d sent", 3);
+  }).join();
+  std::thread([id]() {
+    Logging::setThreadContext(id); // shared
+    INFO("order %d sent", 4);
+  }).join();
+  Logging::setThreadContext(0);
+  INFO("order %d sent", 5);
+  Logging::sync();
+  BOOST_CHECK(sink->_s.find(" [strategy-A] order 1 sent\n") != std::string::npos);
+  BOOST_CHECK(sink->_s.find(" [strategy-A] order 2 sent\n") != std::string::npos);
+  BOOST_CHECK(sink->_s.find(" [strategy-B] order 3 sent\n") != std::string::npos);
+  BOOST_CHECK(sink->_s.find(" [strategy-A] order 4 sent\n") != std::string::npos);
+  size_t at = sink->_s.find(" order 5 sent\n");
+  BOOST_REQUIRE(at != std::string::npos);
+  BOOST_CHECK(sink->_s[at - 1] != ']');
+}
@@ -0,0 +1,202 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+#include "../include/LoggingFormat.hpp"
+#include "../include/LoggingFormatString.hpp"
+#include "LoggingTestSink.hpp"
+#include <string>
+#include <time.h>
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#include <boost/test/included/unit_test.hpp>
+
+template <typename... Args> static std::string format(const char* fmt, Args... args) {
+  auto& f = LoggingHelper::Formatter::local();
+  f.clear();
+  f.begin(fmt);
+  ((f % args), ...);
+  f.end();
+  return std::string(f.data(), f.size());
+}
+
+// compares against snprintf (which also gets gcc's format checking)
+#define CHECK_FMT(F, ...) do { \
+  char expected[1024]; \
+  snprintf(expected, sizeof(expected), F, ##__VA_ARGS__); \
+  std::string actual = format(F, ##__VA_ARGS__); \
+  if (actual != expected) fprintf(stderr, "'%s': got '%s', expected '%s'\n", F, actual.c_str(), expected); \
+  BOOST_CHECK(actual == expected); \
+} while (0)
+
+BOOST_AUTO_TEST_CASE( LoggingFormatTest )
+{
+  CHECK_FMT("plain text");
+  CHECK_FMT("100%% done");
+  CHECK_FMT("%d %i %u", -5, 17, 4000000000U);
+  CHECK_FMT("%ld %lu %lld %llu", -5L, 5UL, -(1LL << 62), ~0ULL);
+  CHECK_FMT("%zd %zu %Zd %td %jd", ssize_t(-3), sizeof(int), size_t(7), ptrdiff_t(-9), intmax_t(11));
+  CHECK_FMT("%hhd %hhu %hd %hu", (signed char)-3, (unsigned char)250, (short)-300, (unsigned short)65000);
+  CHECK_FMT("%x %X %o %#x %#X %#o %#o", 255, 255, 8, 255, 255, 8, 0);
+  CHECK_FMT("[%5d] [%-5d] [%05d] [%+d] [% d] [%+05d] [%.3d] [%8.3d] [%-8.3d|] [%.0d]", 42, 42, 42, 42, 42, -42, 7, 7, -7, 0);
+  CHECK_FMT("[%*d] [%-*d] [%.*d] [%*.*d]", 6, 1, 6, 2, 4, 3, 7, 3, 4);
+  CHECK_FMT("[%*d]", -6, 1);
+  CHECK_FMT("%c%c%c", 'a', 'b', 'c');
+  CHECK_FMT("[%s] [%10s] [%-10s] [%.2s] [%*.*s]", "abc", "abc", "abc", "abc", 5, 1, "abc");
+  CHECK_FMT("%f %.2f %.0f %10.3f %-10.3f| %+f % f %010.2f", 3.14159, 2.675, 2.5, -1.5, 1.5, 1.0, 1.0, -3.25);
+  CHECK_FMT("%e %E %.3e %g %G %.3g %g %g", 12345.678, 0.000123, 1.0, 0.0001, 1e20, 3.14159, 100000.0, 1000000.0);
+  CHECK_FMT("%f %f %.20f", 1e300, -0.0, 0.1);
+  CHECK_FMT("%Lf %.3Le", 1.5L, 2.25L);
+  CHECK_FMT("%a %#g %#.0f", 1.0, 1.5, 3.0);
+  CHECK_FMT("%.4f, Hello there %s %d", 1.0/3, "world", 5);
+  CHECK_FMT("%02d:%02d:%02d.%06ld %s:%d ", 9, 5, 3, 42L, "LoggingTest.cpp", 83);
+  int i = 0;
+  CHECK_FMT("%p %p", (void*)&i, (void*)NULL);
+
+  // not printf-defined, so just make sure they're sane
+  BOOST_CHECK(format("%d %d", 1) == "1 %d");
+  BOOST_CHECK(format("%d", 1, 2) == "1");
+  BOOST_CHECK(format("%m %d", 1) == "%m 1");
+  BOOST_CHECK(format("trailing %") == "trailing %");
+  BOOST_CHECK(format("%s", (const char*)NULL) == "(null)"); // as glibc
+
+  auto& f = LoggingHelper::Formatter::local();
+  f.clear();
+  f.timestamp(((13 * 60LL + 4) * 60 + 59) * 1000000 + 7);
+  f.timestamp(((13 * 60LL + 4) * 60 + 59) * 1000000 + 999999);
+  f.timestamp(((13 * 60LL + 5) * 60 + 0) * 1000000);
+  BOOST_CHECK(std::string(f.data(), f.size()) == "13:04:59.00000713:04:59.99999913:05:00.000000");
+
+  { // rough speed comparison
+    constexpr int N = 200000;
+    char buf[256];
+    timespec s, m, e;
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    for (int j = 0; j < N; ++j) {
+      snprintf(buf, sizeof(buf), "%02d:%02d:%02d.%06ld %s:%d Hello %ld, %d %.2f\n", 1, 2, 3, long(j), "x.cpp", 10, long(j), j, j * 0.5);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &m);
+    for (int j = 0; j < N; ++j) {
+      f.clear();
+      f.timestamp(3723000000LL + j);
+      f.append(" x.cpp:10 ");
+      f.begin("Hello %ld, %d %.2f\n");
+      f % long(j) % j % (j * 0.5);
+      f.end();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    auto nanos = [](const timespec& a, const timespec& b) {
+      return ((b.tv_sec - a.tv_sec) * 1000000000LL + b.tv_nsec - a.tv_nsec) / double(N);
+    };
+    fprintf(stderr, "snprintf: %.1f nanos/line, Formatter: %.1f nanos/line\n", nanos(s, m), nanos(m, e));
+  }
+}
+
+template <typename... Args>
+static std::string braces(LoggingHelper::FormatString<std::type_identity_t<Args>...> format, const Args&... args) {
+  std::vector<LoggingHelper::BraceItem> items;
+  LoggingHelper::parseBraceFormat(format._format, items);
+  auto& f = LoggingHelper::Formatter::local();
+  f.clear();
+  LoggingHelper::renderBraces(f, items, LoggingHelper::CapturedT<Args>(args)...);
+  return std::string(f.data(), f.size());
+}
+
+// expected values are what std::format gives
+#define CHECK_BRACES(E, F, ...) do { \
+  std::string actual = braces(F, ##__VA_ARGS__); \
+  if (actual != E) fprintf(stderr, "'%s': got '%s', expected '%s'\n", F, actual.c_str(), E); \
+  BOOST_CHECK(actual == E); \
+} while (0)
+
+BOOST_AUTO_TEST_CASE( LoggingFormatStringTest )
+{
+  CHECK_BRACES("plain {text}", "plain {{text}}");
+  CHECK_BRACES("1 -2 3 -9223372036854775808", "{} {} {} {}", 1, short(-2), 3u, int64_t(1) << 63);
+  CHECK_BRACES("ff 0XFF 10 010 101 0b101 0B101 0", "{:x} {:#X} {:o} {:#o} {:b} {:#b} {:#B} {:#o}", 255, 255, 8, 8, 5, 5, 5, 0);
+  CHECK_BRACES("[   42] [42   ] [ 42  ] [**42***] [00042] [+42] [ 42] [-0042] [0x00ff]",
+      "[{:5}] [{:<5}] [{:^5}] [{:*^7}] [{:05}] [{:+}] [{: }] [{:+05}] [{:#06x}]", 42, 42, 42, 42, 42, 42, 42, -42, 255);
+  CHECK_BRACES("0.1 1e+20 100 1.5 -0 3.14 1.234568e+04 0.0001 3.14 1.",
+      "{} {} {} {} {} {:.2f} {:e} {:g} {:.3} {:#}", 0.1, 1e20, 100.0, 1.5f, -0.0, 3.14159, 12345.678, 0.0001, 3.14159, 1.0);
+  CHECK_BRACES("1p+0 1P-1 -1.8p+1", "{:a} {:A} {:a}", 1.0, 0.5, -3.0);
+  CHECK_BRACES("    -1.500|1.500     |+000003.25|1.23E+04", "{:10.3f}|{:<10.3f}|{:+010.2f}|{:.2E}", -1.5, 1.5, 3.25, 12345.0);
+  CHECK_BRACES("2.5 2.50000", "{} {:#g}", 2.5L, 2.5);
+  CHECK_BRACES("true 1 false [true  ]", "{} {:d} {:s} [{:6}]", true, true, false, true);
+  CHECK_BRACES("a 97 A [a  ] [  a]", "{} {:d} {:c} [{:3}] [{:>3}]", 'a', 'a', 65, 'a', 'a');
+  std::string str("ab");
+  std::string_view view("hello world");
+  char array[] = "array";
+  CHECK_BRACES("[   abc] [ab] [ab****] hello array (null)", "[{:>6}] [{:.2}] [{:*<6}] {} {} {}",
+      "abc", "abc", str, view.substr(0, 5), array, (const char*)nullptr);
+  CHECK_BRACES("0x1234 0x0 0x0", "{} {} {:p}", (void*)0x1234, nullptr, (const void*)nullptr);
+  CHECK_BRACES("b a b", "{1} {0} {1}", "a", "b");
+
+  // through the binary capture & the background's rendering (to a sink)
+  StringSink sink;
+  static LoggingHelper::LogSite site = { "dir/File.cpp", 12, "{} {:.1f} {} [{:>4}] {}\n" };
+  alignas(64) char slot[1024];
+  auto* p = LoggingHelper::createBracePrinter(sizeof(slot), &sink, slot, std::make_tuple(1, 2, 3, int64_t(4)), site,
+      std::string("copied"), 2.25, view.substr(6), 'c', int64_t(-7));
+  str = "changed";
+  p->print();
+  BOOST_CHECK(sink._s == "01:02:03.000004 File.cpp:12 copied 2.2 world [   c] -7\n");
+  BOOST_CHECK(site.parsed != nullptr);
+  sink._s.clear();
+  p->print(); // again, with the site's parsed format
+  BOOST_CHECK(sink._s == "01:02:03.000004 File.cpp:12 copied 2.2 world [   c] -7\n");
+
+  // LOG_HEX()'s bytes: dumped after the line, or as hex for a {}
+  const char packet[] = "Hello, binary world!\x01\x02\xff";
+  auto dump = [&](LoggingHelper::BinaryFormat style, uint32_t len) {
+    static LoggingHelper::LogSite hexSite = { "Hex.cpp", 7, "packet {}\n" };
+    LoggingHelper::Bytes bytes = { packet, len, uint32_t(sizeof(packet) - 1) };
+    sink._s.clear();
+    LoggingHelper::createBinaryPrinter(sizeof(slot), &sink, slot, std::make_tuple(0, 0, 0, int64_t(1)), hexSite, style, bytes, 3)->print();
+    return sink._s;
+  };
+  BOOST_CHECK(dump(LoggingHelper::BinaryFormat::HEXDUMP, 23) == "00:00:00.000001 Hex.cpp:7 packet 3\n"
+      "  0000  48 65 6c 6c 6f 2c 20 62  69 6e 61 72 79 20 77 6f  |Hello, binary wo|\n"
+      "  0010  72 6c 64 21 01 02 ff                              |rld!...|\n");
+  BOOST_CHECK(dump(LoggingHelper::BinaryFormat::BASE64, 5) == "00:00:00.000001 Hex.cpp:7 packet 3\n"
+      "  SGVsbG8=\n  (truncated: 5 of 23 bytes logged)\n");
+  BOOST_CHECK(dump(LoggingHelper::BinaryFormat::BASE64, 6) == "00:00:00.000001 Hex.cpp:7 packet 3\n"
+      "  SGVsbG8s\n  (truncated: 6 of 23 bytes logged)\n");
+  CHECK_BRACES("[0102ff] [0102...]", "[{}] [{}]", (LoggingHelper::Bytes{ packet + 20, 3, 3 }), (LoggingHelper::Bytes{ packet + 20, 2, 3 }));
+
+  { // rough speed comparison with the printf style
+    constexpr int N = 200000;
+    timespec s, m, e;
+    auto& f = LoggingHelper::Formatter::local();
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    for (int j = 0; j < N; ++j) {
+      f.clear();
+      f.begin("Hello %ld, %d %.2f\n");
+      f % long(j) % j % (j * 0.5);
+      f.end();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &m);
+    std::vector<LoggingHelper::BraceItem> items;
+    LoggingHelper::parseBraceFormat("Hello {}, {} {:.2f}\n", items);
+    for (int j = 0; j < N; ++j) {
+      f.clear();
+      LoggingHelper::renderBraces(f, items, long(j), j, j * 0.5);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    auto nanos = [](const timespec& a, const timespec& b) {
+      return ((b.tv_sec - a.tv_sec) * 1000000000LL + b.tv_nsec - a.tv_nsec) / double(N);
+    };
+    fprintf(stderr, "printf style: %.1f nanos/line, {} style: %.1f nanos/line\n", nanos(s, m), nanos(m, e));
+  }
+}
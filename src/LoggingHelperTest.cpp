@@ -29,3 +29,15 @@ BOOST_AUTO_TEST_CASE( LoggingHelperTest )
   auto* f __attribute__((__may_alias__)) = reinterpret_cast<LoggingHelper::Printer*>(buf);
   f->print();
 }
+
+BOOST_AUTO_TEST_CASE( LoggingPolicyTest )
+{
+  BOOST_CHECK(LoggingHelper::Util::splitTime((86400 + 3661) * 1000000000LL + 5000) == std::make_tuple(1, 1, 1, int64_t(5)));
+  auto secs = [](const std::tuple<int, int, int, int64_t>& t) { return (std::get<0>(t) * 60 + std::get<1>(t)) * 60 + std::get<2>(t); };
+  int viaUtil = secs(LoggingHelper::UtilPolicy::timeParts());
+  int inlined = secs(LoggingHelper::InlinePolicy::timeParts());
+  BOOST_CHECK(inlined - viaUtil <= 1 && (inlined >= viaUtil || inlined == 0)); // (unless midnight came between)
+  char out[4];
+  BOOST_CHECK(LoggingHelper::InlinePolicy::encrypt("abc", out, 3) == 3 && memcmp(out, "abc", 3) == 0);
+  BOOST_CHECK((std::is_same_v<LoggingHelper::Policy, LoggingHelper::UtilPolicy>)); // the default
+}
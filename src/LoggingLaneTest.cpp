@@ -0,0 +1,52 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+#include "LoggingTestSink.hpp"
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#include <boost/test/included/unit_test.hpp>
+
+BOOST_AUTO_TEST_CASE( LoggingLaneTest )
+{
+  auto* sink = initPollLogger();
+  for (int i = 0; i < 5; ++i) INFO("backlog %d", i);
+  ZZWARN("jumps the queue");
+  BOOST_CHECK(Logging::poll(1) == 1);
+  BOOST_CHECK(sink->_s.find("!!WARNING!! jumps the queue\n") != std::string::npos);
+  BOOST_CHECK(sink->_s.find("backlog") == std::string::npos);
+  BOOST_CHECK(Logging::poll() == 5);
+
+  // FATAL() writes its own line out before throwing, without waiting on (or writing) the INFO backlog
+  sink->_s.clear();
+  for (int i = 0; i < 5; ++i) INFO("backlog %d", i);
+  bool threw = false;
+  try {
+    FATAL("giving up on %d", 42);
+  } catch (const std::exception&) {
+    threw = true;
+    BOOST_CHECK(sink->_s.find("!!FATAL!! giving up on 42\n") != std::string::npos);
+    BOOST_CHECK(sink->lines() == 1);
+  }
+  BOOST_CHECK(threw);
+  LOG_WARN("as {}", "LOG_WARN");
+  Logging::flushHighPriority();
+  BOOST_CHECK(sink->lines() == 2);
+  Logging::sync();
+  BOOST_CHECK(sink->lines() == 7);
+  // (the backlog is written after the warning, but keeps the timestamp it was logged with)
+  BOOST_CHECK(sink->_s.find("backlog 4\n") > sink->_s.find("!!WARNING!! as LOG_WARN\n"));
+}
@@ -0,0 +1,62 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+#include "LoggingTestSink.hpp"
+#include <dirent.h>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#include <boost/test/included/unit_test.hpp>
+
+static int threadCount() {
+  int n = 0;
+  DIR* d = opendir("/proc/self/task");
+  while (dirent* e = readdir(d)) if (e->d_name[0] != '.') ++n;
+  closedir(d);
+  return n;
+}
+
+BOOST_AUTO_TEST_CASE( LoggingPollTest )
+{
+  auto* sink = initPollLogger();
+  BOOST_CHECK(threadCount() == 1); // no logging thread
+
+  for (int i = 0; i < 10; ++i) INFO("line %d", i);
+  BOOST_CHECK(sink->_s.empty()); // nothing's written until we poll
+  BOOST_CHECK(Logging::poll(3) == 3);
+  BOOST_CHECK(sink->lines() == 3);
+  BOOST_CHECK(Logging::poll(SIZE_MAX, 0) == 1); // out of time after the first
+  BOOST_CHECK(Logging::poll() == 6);
+  BOOST_CHECK(Logging::poll() == 0);
+
+  // more than the queue holds: producers make room themselves rather than waiting on a thread that isn't there
+  for (int i = 10; i < 100; ++i) LOG_INFO("line {}", i);
+  BOOST_CHECK(sink->lines() > 10);
+  Logging::sync();
+  BOOST_CHECK(sink->lines() == 100);
+  for (int i = 0; i < 100; ++i) {
+    std::string expected = " line " + std::to_string(i) + "\n";
+    size_t at = sink->_s.find(expected);
+    BOOST_REQUIRE(at != std::string::npos);
+    if (i > 0) BOOST_CHECK(at > sink->_s.find(" line " + std::to_string(i - 1) + "\n"));
+  }
+
+  // a rough idea of the cost of an empty poll (e.g. from a busy event loop)
+  constexpr int N = 100000;
+  int64_t start = detail::LoggingBackgroundThread::monotonicNanos();
+  for (int i = 0; i < N; ++i) Logging::poll();
+  fprintf(stderr, "Empty poll(): %.1f nanos\n", (detail::LoggingBackgroundThread::monotonicNanos() - start) / double(N));
+}
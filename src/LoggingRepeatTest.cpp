@@ -0,0 +1,48 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+#include "LoggingTestSink.hpp"
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#include <boost/test/included/unit_test.hpp>
+
+BOOST_AUTO_TEST_CASE( LoggingRepeatTest )
+{
+  Logging::Config config;
+  config.suppressRepeats = true;
+  auto* sink = initPollLogger(config);
+  for (int i = 0; i < 1000; ++i) INFO("feed %s is down", "XHKG");
+  INFO("feed %s is down", "XSES"); // the same site, but different arguments
+  for (int i = 0; i < 3; ++i) LOG_INFO("feed {} is {}", std::string("XHKG"), "flapping");
+  Logging::fprintf(stdout, "no prefix\n"); // (never collapsed)
+  Logging::fprintf(stdout, "no prefix\n");
+  INFO("done");
+  Logging::sync();
+  BOOST_CHECK(sink->lines() == 8);
+  size_t at = sink->_s.find(" feed XHKG is down\n");
+  BOOST_REQUIRE(at != std::string::npos);
+  at = sink->_s.find(" last message repeated 999 times (", at);
+  BOOST_REQUIRE(at != std::string::npos);
+  at = sink->_s.find(" feed XSES is down\n", at);
+  BOOST_REQUIRE(at != std::string::npos);
+  at = sink->_s.find(" feed XHKG is flapping\n", at);
+  BOOST_REQUIRE(at != std::string::npos);
+  at = sink->_s.find(" last message repeated 2 times (", at);
+  BOOST_REQUIRE(at != std::string::npos);
+  BOOST_CHECK(sink->_s.find("no prefix\nno prefix\n", at) != std::string::npos);
+  BOOST_CHECK(sink->_s.find(" done\n", at) != std::string::npos);
+}
@@ -0,0 +1,338 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+#include "../include/LoggingHelper.hpp"
+#include "../include/LoggingSink.hpp"
+#include "../include/LoggingCompress.hpp"
+#include <fstream>
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#include <boost/test/included/unit_test.hpp>
+
+// the contents of a (possibly compressed) log file, checking it's one complete stream
+static std::string readLog(const std::string& name) {
+  std::ifstream f(name);
+  std::string raw((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  std::string s;
+#ifdef LOGGING_HAVE_ZSTD
+  if (name.ends_with(".zst")) {
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    ZSTD_inBuffer in = { raw.data(), raw.size(), 0 };
+    size_t rc = 0;
+    while (in.pos < in.size) {
+      char buf[4096];
+      ZSTD_outBuffer out = { buf, sizeof(buf), 0 };
+      rc = ZSTD_decompressStream(dctx, &out, &in);
+      BOOST_REQUIRE(!ZSTD_isError(rc));
+      s.append(buf, out.pos);
+    }
+    ZSTD_freeDCtx(dctx);
+    BOOST_REQUIRE(rc == 0); // i.e., the frame's complete
+    return s;
+  }
+#endif
+#ifdef LOGGING_HAVE_LZ4
+  if (name.ends_with(".lz4")) {
+    LZ4F_dctx* dctx = nullptr;
+    BOOST_REQUIRE(!LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)));
+    size_t at = 0, rc = 0;
+    while (at < raw.size()) {
+      char buf[4096];
+      size_t outLen = sizeof(buf), inLen = raw.size() - at;
+      rc = LZ4F_decompress(dctx, buf, &outLen, raw.data() + at, &inLen, nullptr);
+      BOOST_REQUIRE(!LZ4F_isError(rc));
+      s.append(buf, outLen);
+      at += inLen;
+    }
+    LZ4F_freeDecompressionContext(dctx);
+    BOOST_REQUIRE(rc == 0); // i.e., the frame's complete
+    return s;
+  }
+#endif
+  gzFile gz = gzopen(name.c_str(), "rb"); // reads uncompressed files as-is too
+  BOOST_REQUIRE(gz != NULL);
+  char buf[4096];
+  int n;
+  while ((n = gzread(gz, buf, sizeof(buf))) > 0) s.append(buf, n);
+  BOOST_REQUIRE(gzclose(gz) == Z_OK); // i.e., each file is a complete stream
+  return s;
+}
+
+// writes 1000 lines through a sink made from cfg, then checks & removes what ended up on disk
+static void runSinkTest(LoggingHelper::RotatingFileConfig cfg) {
+  char dir[] = "/tmp/LoggingSinkTestXXXXXX";
+  BOOST_REQUIRE(mkdtemp(dir) != NULL);
+  cfg.path = std::string(dir) + "/test.log";
+  std::string expected;
+  std::vector<std::string> files;
+  {
+    LoggingHelper::RotatingFileSink sink(cfg);
+    for (int i = 0; i < 1000; ++i) {
+      char line[64];
+      int len = snprintf(line, sizeof(line), "This is line #%d\n", i);
+      sink.write(line, len);
+      expected.append(line, len);
+      if (i % 100 == 99) sink.flush(); // (as the background thread does when it goes idle)
+    }
+    fprintf(stderr, "Wrote %ld bytes over %ld files\n", int64_t(expected.size()), sink.currentSeq() + 1);
+    BOOST_REQUIRE(sink.currentSeq() > 1);
+    for (int64_t seq = 0; seq <= sink.currentSeq(); ++seq) files.push_back(sink.fileName(seq));
+  }
+  std::string actual;
+  for (const auto& name: files) {
+    struct stat st;
+    BOOST_REQUIRE(::stat(name.c_str(), &st) == 0);
+    BOOST_REQUIRE(size_t(st.st_size) <= cfg.maxBytes); // & no preallocated zeroes left at the end
+    std::string s = readLog(name);
+    BOOST_REQUIRE(s.size() > 0 && s.back() == '\n'); // lines never span files
+    actual += s;
+    ::unlink(name.c_str());
+  }
+  BOOST_REQUIRE(actual == expected);
+  BOOST_REQUIRE(::rmdir(dir) == 0); // i.e., the prepared-but-unused next file was cleaned up too
+}
+
+BOOST_AUTO_TEST_CASE( LoggingSinkTest )
+{
+  LoggingHelper::RotatingFileConfig cfg;
+  cfg.maxBytes = 4096;
+  cfg.bufferBytes = 1024;
+  runSinkTest(cfg);
+}
+
+BOOST_AUTO_TEST_CASE( LoggingSinkCompressedTest )
+{
+  LoggingHelper::RotatingFileConfig cfg;
+  cfg.maxBytes = 1024;
+  cfg.bufferBytes = 1024;
+  cfg.compressor = LoggingHelper::makeCompressor<LoggingHelper::GzipCompressor>();
+  runSinkTest(cfg);
+}
+
+// (built against the library where its header's found, as LoggingCompress.hpp & the Makefile do)
+BOOST_AUTO_TEST_CASE( LoggingSinkZstdTest )
+{
+#ifdef LOGGING_HAVE_ZSTD
+  LoggingHelper::RotatingFileConfig cfg;
+  cfg.maxBytes = 1024;
+  cfg.bufferBytes = 1024;
+  cfg.compressor = LoggingHelper::makeCompressor<LoggingHelper::ZstdCompressor>();
+  runSinkTest(cfg);
+#else
+  fprintf(stderr, "(no zstd.h, so ZstdCompressor isn't tested)\n");
+#endif
+}
+
+BOOST_AUTO_TEST_CASE( LoggingSinkLz4Test )
+{
+#ifdef LOGGING_HAVE_LZ4
+  LoggingHelper::RotatingFileConfig cfg;
+  cfg.maxBytes = 1024;
+  cfg.bufferBytes = 1024;
+  cfg.compressor = LoggingHelper::makeCompressor<LoggingHelper::Lz4Compressor>();
+  runSinkTest(cfg);
+#else
+  fprintf(stderr, "(no lz4frame.h, so Lz4Compressor isn't tested)\n");
+#endif
+}
+
+// sinks made from the same config each get their own compressor (rather than interleaving into one stream)
+BOOST_AUTO_TEST_CASE( LoggingSinkSharedConfigTest )
+{
+  char dir[] = "/tmp/LoggingSinkTestXXXXXX";
+  BOOST_REQUIRE(mkdtemp(dir) != NULL);
+  LoggingHelper::RotatingFileConfig cfg;
+  cfg.maxBytes = 0;
+  cfg.bufferBytes = 64;
+  cfg.compressor = LoggingHelper::makeCompressor<LoggingHelper::GzipCompressor>();
+  LoggingHelper::RotatingFileConfig a = cfg, b = cfg;
+  a.path = std::string(dir) + "/a.log";
+  b.path = std::string(dir) + "/b.log";
+  std::string expectedA, expectedB;
+  {
+    LoggingHelper::RotatingFileSink sinkA(a), sinkB(b);
+    for (int i = 0; i < 100; ++i) {
+      std::string lineA = "a line #" + std::to_string(i) + "\n", lineB = "b line #" + std::to_string(i) + "\n";
+      sinkA.write(lineA.data(), lineA.size());
+      sinkB.write(lineB.data(), lineB.size());
+      expectedA += lineA;
+      expectedB += lineB;
+      if (i % 10 == 0) {
+        sinkA.flush();
+        sinkB.flush();
+      }
+    }
+  }
+  BOOST_CHECK(readLog(a.path + ".0.gz") == expectedA);
+  BOOST_CHECK(readLog(b.path + ".0.gz") == expectedB);
+  ::unlink((a.path + ".0.gz").c_str());
+  ::unlink((b.path + ".0.gz").c_str());
+  BOOST_REQUIRE(::rmdir(dir) == 0);
+}
+
+BOOST_AUTO_TEST_CASE( LoggingSinkIndexTest )
+{
+  char dir[] = "/tmp/LoggingSinkTestXXXXXX";
+  BOOST_REQUIRE(mkdtemp(dir) != NULL);
+  LoggingHelper::RotatingFileConfig cfg;
+  cfg.path = std::string(dir) + "/test.log";
+  cfg.maxBytes = 1 << 16;
+  cfg.indexMillis = 100;
+  std::vector<std::string> files;
+  int64_t start = LoggingHelper::Printer::microsSinceMidnight(LoggingHelper::Util::splitTime(0)) / 1000 * 1000;
+  {
+    LoggingHelper::RotatingFileSink sink(cfg);
+    for (int i = 0; i < 3000; ++i) { // a line a millisecond
+      int64_t micros = (start + i * 1000LL) % (24LL * 60 * 60 * 1000 * 1000);
+      char line[64];
+      int len = snprintf(line, sizeof(line), "%02d:%02d:%02d.%06d line #%d\n", int(micros / 3600000000LL),
+          int(micros / 60000000 % 60), int(micros / 1000000 % 60), int(micros % 1000000), i);
+      sink.writeLine(line, len, micros);
+      if (i == 1000) sink.flush(); // (the index is written out as the file is)
+    }
+    BOOST_REQUIRE(sink.currentSeq() > 0);
+    for (int64_t seq = 0; seq <= sink.currentSeq(); ++seq) files.push_back(sink.fileName(seq));
+  }
+  size_t entries = 0;
+  for (const auto& name: files) {
+    std::ifstream logf(name), idxf(name + ".idx");
+    std::string log((std::istreambuf_iterator<char>(logf)), std::istreambuf_iterator<char>());
+    std::string idx((std::istreambuf_iterator<char>(idxf)), std::istreambuf_iterator<char>());
+    BOOST_REQUIRE(idx.size() > 0 && idx.size() % sizeof(LoggingHelper::IndexEntry) == 0);
+    const auto* e = reinterpret_cast<const LoggingHelper::IndexEntry*>(idx.data());
+    size_t n = idx.size() / sizeof(LoggingHelper::IndexEntry);
+    BOOST_CHECK(e[0].offset == 0);
+    for (size_t i = 0; i < n; ++i) {
+      BOOST_REQUIRE(e[i].offset < log.size());
+      BOOST_CHECK(e[i].offset == 0 || log[e[i].offset - 1] == '\n');
+      int64_t micros = e[i].micros % (24LL * 60 * 60 * 1000 * 1000);
+      char prefix[32];
+      snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%06d ", int(micros / 3600000000LL), int(micros / 60000000 % 60),
+          int(micros / 1000000 % 60), int(micros % 1000000));
+      BOOST_CHECK(log.compare(e[i].offset, strlen(prefix), prefix) == 0); // the entry's time is its line's
+      if (i > 0) BOOST_CHECK(e[i].micros - e[i - 1].micros == 100 * 1000);
+      BOOST_CHECK(e[i].minMicros == e[i].micros); // (the lines were in time order)
+      BOOST_CHECK(e[i].maxMicros >= e[i].micros && e[i].maxMicros < e[i].micros + 100 * 1000);
+      if (i + 1 < n) BOOST_CHECK(e[i].maxMicros == e[i + 1].micros - 1000);
+    }
+    entries += n;
+    ::unlink(name.c_str());
+    ::unlink((name + ".idx").c_str());
+  }
+  BOOST_CHECK(entries >= 30);
+  BOOST_REQUIRE(::rmdir(dir) == 0);
+
+  cfg.compressor = LoggingHelper::makeCompressor<LoggingHelper::GzipCompressor>();
+  bool threw = false;
+  try {
+    LoggingHelper::RotatingFileSink sink(cfg);
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  BOOST_CHECK(threw);
+}
+
+// bin/logseek over rotated files & their indexes, with lines a little out of time order (as lanes & producers
+// interleave) & a range across midnight
+BOOST_AUTO_TEST_CASE( LoggingSinkSeekTest )
+{
+  constexpr int64_t SECOND = 1000LL * 1000;
+  constexpr int64_t MIDNIGHT = 1700092800LL * SECOND; // (epoch micros)
+  LoggingHelper::SimulatedClock::nanos() = (MIDNIGHT + 3 * SECOND) * 1000; // (what the index's dates are taken from)
+  char dir[] = "/tmp/LoggingSinkTestXXXXXX";
+  BOOST_REQUIRE(mkdtemp(dir) != NULL);
+  LoggingHelper::RotatingFileConfig cfg;
+  cfg.path = std::string(dir) + "/test.log";
+  cfg.maxBytes = 1 << 14;
+  cfg.bufferBytes = 1 << 12;
+  cfg.indexMillis = 100;
+  std::vector<std::pair<int64_t, std::string>> lines; // in the order written
+  std::vector<std::string> files;
+  {
+    LoggingHelper::RotatingFileSink sink(cfg);
+    for (int i = 0; i < 4000; ++i) { // a line a millisecond from 23:59:58, every 10th 250ms late
+      int64_t t = MIDNIGHT - 2 * SECOND + i * 1000LL - (i % 10 == 5 ? 250 * 1000 : 0);
+      int64_t micros = (t % (24 * 3600 * SECOND));
+      char line[64];
+      int len = snprintf(line, sizeof(line), "%02d:%02d:%02d.%06d line #%d\n", int(micros / 3600000000LL),
+          int(micros / 60000000 % 60), int(micros / 1000000 % 60), int(micros % 1000000), i);
+      sink.writeLine(line, len, micros);
+      lines.push_back({ t, line });
+    }
+    BOOST_REQUIRE(sink.currentSeq() > 2);
+    for (int64_t seq = 0; seq <= sink.currentSeq(); ++seq) files.push_back(sink.fileName(seq));
+  }
+  LoggingHelper::SimulatedClock::nanos() = -1;
+
+  auto seek = [&](const std::string& from, const std::string& to) {
+    std::string out;
+    for (const auto& name: files) {
+      FILE* f = popen(("bin/logseek " + name + " " + from + " " + to).c_str(), "r");
+      BOOST_REQUIRE(f != NULL);
+      char buf[4096];
+      size_t n;
+      while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+      BOOST_REQUIRE(pclose(f) == 0);
+    }
+    return out;
+  };
+  auto expected = [&](int64_t from, int64_t to) {
+    std::string ret;
+    for (const auto& [t, line]: lines) if (t >= from && t <= to) ret += line;
+    return ret;
+  };
+  std::string across = seek("23:59:59.500", "00:00:00.500");
+  BOOST_CHECK(!across.empty());
+  BOOST_CHECK(across == expected(MIDNIGHT - SECOND / 2, MIDNIGHT + SECOND / 2));
+  BOOST_CHECK(seek("00:00:01", "00:00:01.200") == expected(MIDNIGHT + SECOND, MIDNIGHT + SECOND + SECOND / 5));
+  BOOST_CHECK(seek(std::to_string(MIDNIGHT / 1000 - 100), std::to_string(MIDNIGHT / 1000 + 100)) ==
+      expected(MIDNIGHT - SECOND / 10, MIDNIGHT + SECOND / 10));
+  for (const auto& name: files) {
+    ::unlink(name.c_str());
+    ::unlink((name + ".idx").c_str());
+  }
+  BOOST_REQUIRE(::rmdir(dir) == 0);
+}
+
+// a second run into the same directory carries on after the first run's files, leaving them (& their indexes) alone
+BOOST_AUTO_TEST_CASE( LoggingSinkReopenTest )
+{
+  char dir[] = "/tmp/LoggingSinkTestXXXXXX";
+  BOOST_REQUIRE(mkdtemp(dir) != NULL);
+  LoggingHelper::RotatingFileConfig cfg;
+  cfg.path = std::string(dir) + "/test.log";
+  cfg.indexMillis = 100;
+  int64_t micros = LoggingHelper::Printer::microsSinceMidnight(LoggingHelper::Util::splitTime(0));
+  auto run = [&](const char* line) {
+    LoggingHelper::RotatingFileSink sink(cfg);
+    sink.writeLine(line, strlen(line), micros);
+    return sink.currentSeq();
+  };
+  auto contents = [](const std::string& name) {
+    std::ifstream f(name);
+    return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  };
+  BOOST_CHECK(run("first run\n") == 0);
+  std::string idx0 = contents(cfg.path + ".0.idx");
+  BOOST_REQUIRE(idx0.size() == sizeof(LoggingHelper::IndexEntry));
+  BOOST_CHECK(run("second run\n") == 1);
+  BOOST_CHECK(contents(cfg.path + ".0") == "first run\n");
+  BOOST_CHECK(contents(cfg.path + ".0.idx") == idx0);
+  BOOST_CHECK(contents(cfg.path + ".1") == "second run\n");
+  BOOST_CHECK(contents(cfg.path + ".1.idx").size() == sizeof(LoggingHelper::IndexEntry));
+  for (const char* suffix: { ".0", ".0.idx", ".1", ".1.idx" }) ::unlink((cfg.path + suffix).c_str());
+  BOOST_REQUIRE(::rmdir(dir) == 0);
+}
@@ -0,0 +1,117 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+#include "LoggingTestSink.hpp"
+#include <sys/wait.h>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#include <boost/test/included/unit_test.hpp>
+
+BOOST_AUTO_TEST_CASE( LoggingSiteTest )
+{
+  auto* sink = initPollLogger();
+  int line = __LINE__ + 1;
+  auto fill = [](int i) { INFO("fill %d", i); };
+  std::string site = "LoggingSiteTest.cpp:" + std::to_string(line);
+  BOOST_CHECK(Logging::enableSites(site, false) == 0); // (hasn't run yet, so isn't known)
+  fill(1);
+  BOOST_CHECK(Logging::enableSites(site, false) == 1);
+  fill(2);
+  INFO("other %d", 3); // (a different site)
+  BOOST_CHECK(Logging::enableSites(site) == 1);
+  fill(4);
+  Logging::sync();
+  BOOST_CHECK(sink->_s.find(" fill 1\n") != std::string::npos);
+  BOOST_CHECK(sink->_s.find(" fill 2\n") == std::string::npos);
+  BOOST_CHECK(sink->_s.find(" other 3\n") != std::string::npos);
+  BOOST_CHECK(sink->_s.find(" fill 4\n") != std::string::npos);
+
+  // moved to /dev/shm, where another process (logctl) can see & flip the same switches
+  std::string name = "/LoggingSiteTest." + std::to_string(getpid());
+  int ready[2];
+  BOOST_REQUIRE(pipe(ready) == 0);
+  pid_t other = fork();
+  if (other == 0) { // another process with the same name, which holds the table until killed
+    LoggingHelper::SiteTable::attach(name);
+    char c = 1;
+    if (write(ready[1], &c, 1) == 1) pause();
+    _exit(1);
+  }
+  char c = 0;
+  BOOST_REQUIRE(read(ready[0], &c, 1) == 1);
+  bool threw = false;
+  try {
+    LoggingHelper::SiteTable::attach(name); // (its process is running)
+  } catch (const std::runtime_error& e) {
+    threw = strstr(e.what(), ("in use by process " + std::to_string(other)).c_str()) != nullptr;
+  }
+  BOOST_CHECK(threw);
+  kill(other, SIGKILL); // (so its table's left behind)
+  waitpid(other, nullptr, 0);
+  close(ready[0]);
+  close(ready[1]);
+  LoggingHelper::SiteTable::attach(name); // replaces the dead process's table
+  auto* table = LoggingHelper::SiteTable::open(name);
+  BOOST_CHECK(table->header.pid == getpid());
+  bool listed = false;
+  for (uint32_t i = 0; i < table->header.count; ++i) {
+    listed |= (table->entries[i].line == line && strcmp(table->entries[i].format, "fill %d") == 0);
+  }
+  BOOST_CHECK(listed);
+  uint32_t count = table->header.count;
+  BOOST_CHECK(LoggingHelper::SiteTable::set(table, "LoggingSiteTest.cpp", false) >= 2);
+  fill(5);
+  LOG_INFO("new {}", 6); // (registers after the move, on to start with)
+  BOOST_CHECK(table->header.count == count + 1);
+  BOOST_CHECK(LoggingHelper::SiteTable::set(table, "*", true) >= 3);
+  fill(7);
+  Logging::sync();
+  BOOST_CHECK(sink->_s.find(" fill 5\n") == std::string::npos);
+  BOOST_CHECK(sink->_s.find(" new 6\n") != std::string::npos);
+  BOOST_CHECK(sink->_s.find(" fill 7\n") != std::string::npos);
+
+  // logctl won't map something too small to be a table (touching past its end would be a SIGBUS)
+  std::string shortName = name + ".short";
+  int fd = shm_open(shortName.c_str(), O_CREAT | O_RDWR, 0600);
+  BOOST_REQUIRE(fd >= 0);
+  close(fd);
+  threw = false;
+  try {
+    LoggingHelper::SiteTable::open(shortName);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  BOOST_CHECK(threw);
+  shm_unlink(shortName.c_str());
+
+  // FATAL()s have no switch, so are still written (& still throw) with every site off
+  auto fatal = [](int i) {
+    try {
+      if (i % 2 == 0) FATAL("fatal %d", i);
+      LOG_FATAL("fatal {}", i);
+    } catch (const std::exception&) {
+      return true;
+    }
+    return false;
+  };
+  BOOST_CHECK(fatal(0) && fatal(1)); // (each has run once, so any switch it had would be listed)
+  BOOST_CHECK(LoggingHelper::SiteTable::set(table, "*", false) >= 3);
+  BOOST_CHECK(fatal(2) && fatal(3));
+  Logging::sync();
+  BOOST_CHECK(sink->_s.find("!!FATAL!! fatal 2\n") != std::string::npos);
+  BOOST_CHECK(sink->_s.find("!!FATAL!! fatal 3\n") != std::string::npos);
+}
@@ -14,7 +14,7 @@
   *  limitations under the License.
   *
 ***/
-#include "../include/Logging.hpp"
+#include "LoggingTestSink.hpp"
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MAIN
@@ -30,6 +30,13 @@ __attribute__((hot, always_inline))
     return ret;
   }
 
+// counts what the background thread has written & synced
+struct CountingSink: public LoggingHelper::Sink {
+  void write(const char* buf, size_t len) override { _lines += std::count(buf, buf + len, '\n'); }
+  void sync() override { _syncedLines = _lines.load(); }
+  std::atomic<int> _lines = 0, _syncedLines = 0;
+};
+
 static constexpr size_t LOOP_NUM=200;
 static constexpr size_t REPEATS=4;
 
@@ -57,6 +64,12 @@ int64_t runBackgroundTest() {
 
 BOOST_AUTO_TEST_CASE( LoggingTest )
 {
+  Logging::Config config;
+  config.queueCapacity = 1024;
+  config.slotSize = 1024 * 4;
+  config.consumerCpu = 0;
+  Logging::init(config);
+  BOOST_CHECK_THROW(Logging::init(config), std::runtime_error); // too late now
   Logging::logOnJunk() = true;
   int64_t backgroundTest=0, printfTest=0;
   for (size_t i = 0; i < REPEATS; ++i) {
@@ -69,7 +82,7 @@ BOOST_AUTO_TEST_CASE( LoggingTest )
       backgroundTest / double(LOOP_NUM * REPEATS),
       printfTest / double(LOOP_NUM * REPEATS),
       (printfTest - backgroundTest) / double(LOOP_NUM * REPEATS));
-  INFO("This should cause a boost::format error: %zd", sizeof(int));
+  INFO("%%zd (a glibc extension) is supported: %zd", sizeof(int));
   try {
     FATAL("This is a fatal exception (but I'm catching it)");
   } catch (std::runtime_error& e) {
@@ -91,5 +104,60 @@ BOOST_AUTO_TEST_CASE( LoggingTest )
     }
     Logging::fprintf(stdout, "This is a test of straight logging on line %ld.\n", __LINE__);
   }
+  { // std::format style
+    std::string s = "testMe";
+    LOG_INFO("String contains '{}' which is {} characters long", s, s.size());
+    LOG_WARN("{:>8.2f} {:#x} {}", 3.14159, 255, std::string_view(s).substr(4));
+    unsigned char packet[40];
+    for (size_t i = 0; i < sizeof(packet); ++i) packet[i] = i * 7;
+    LOG_HEX(packet, sizeof(packet), "A {}-byte packet", sizeof(packet));
+    ::detail::LoggingBackgroundThread::on() = false;
+    LOG_INFO("Formatted {} (with background logging off)", "here");
+    LOG_HEX(packet, 4, "A {}-byte packet (with background logging off)", 4);
+    ::detail::LoggingBackgroundThread::on() = true;
+    Logging::sync();
+    bool caught = false;
+    try {
+      LOG_FATAL("That's all '{}' (expected to be caught)", s);
+    } catch (std::runtime_error& e) {
+      caught = true;
+    }
+    BOOST_CHECK(caught);
+    Logging::sync();
+  }
+  { // tickets: wait for our own lines only
+    auto* sink = new CountingSink();
+    LoggingHelper::SinkRegistry::registry().add("counting", sink);
+    for (int i = 0; i < 100; ++i) Logging::fprintf(sink, "line %d\n", i);
+    auto ticket = Logging::fprintf(sink, "checkpoint\n");
+    BOOST_CHECK(ticket.lane == LoggingHelper::Lane::NORMAL);
+    BOOST_CHECK(Logging::flushUntil(ticket, 5LL * 1000 * 1000 * 1000, true));
+    BOOST_CHECK(sink->_lines >= 101);
+    BOOST_CHECK(sink->_syncedLines >= 101);
+    ZZWARN("a warning's ticket is for the high priority lane");
+    BOOST_CHECK(Logging::lastTicket().lane == LoggingHelper::Lane::HIGH);
+    BOOST_CHECK(Logging::flushUntil());
+    Logging::Ticket never = { LoggingHelper::Lane::NORMAL, ticket.seq + 1000 };
+    BOOST_CHECK(!Logging::flushUntil(never, 1000 * 1000)); // times out
+  }
 }
 
+// Logging::fprintf() formats needn't be literals: they're copied with the arguments, so may be freed or reused
+BOOST_AUTO_TEST_CASE( LoggingDynamicFormatTest )
+{
+  auto* sink = new StringSink();
+  LoggingHelper::SinkRegistry::registry().add("dynamic", sink);
+  std::string expected;
+  for (int i = 0; i < 1000; ++i) {
+    Logging::fprintf(sink, (std::string("temporary ") + std::to_string(i) + " %d\n").c_str(), i); // freed at once
+    expected += "temporary " + std::to_string(i) + " " + std::to_string(i) + "\n";
+  }
+  char fmt[64];
+  strcpy(fmt, "first %s\n");
+  Logging::fprintf(sink, fmt, "strs");
+  strcpy(fmt, "second str %d\n"); // the same address, parsed differently
+  Logging::fprintf(sink, fmt, 1);
+  expected += "first strs\nsecond str 1\n";
+  Logging::sync();
+  BOOST_CHECK(sink->_s == expected);
+}
@@ -0,0 +1,47 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+
+/** Sinks & helpers shared by the tests **/
+
+#ifndef LOGGING_TEST_SINK_DEFINE
+#define LOGGING_TEST_SINK_DEFINE
+
+#include "../include/Logging.hpp"
+#include <algorithm>
+#include <string>
+
+// what the background thread (or poll()) wrote: read it after a sync()
+struct StringSink: public LoggingHelper::Sink {
+  void write(const char* buf, size_t len) override { _s.append(buf, len); }
+  size_t lines() const { return std::count(_s.begin(), _s.end(), '\n'); }
+  std::string _s;
+};
+
+// a poll mode logger (no background thread), with stdout & stderr both going to the returned sink, which is left for
+// the exit handler (which may still write to it). Each test binary calls this once, as Logging::init() can only run once
+inline StringSink* initPollLogger(Logging::Config config = Logging::Config()) {
+  config.queueCapacity = 16;
+  config.slotSize = 1024;
+  config.pollMode = true;
+  Logging::init(config);
+  auto* sink = new StringSink();
+  Logging::redirect(stdout, sink);
+  Logging::redirect(stderr, sink);
+  return sink;
+}
+
+#endif
@@ -0,0 +1,335 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+// Benchmarks the queues on their own (RuntimeMessageQueue & the compile time sized MessageQueue): SPSC, locked-writer
+// MPSC & multi-reader fan-out, over a few payload sizes, capacities & thread placements (the reader on the same core,
+// a sibling hyperthread, another core & another socket from the writer, as /sys says the machine has).
+// Reports throughput, write->read latency percentiles & (where perf_event_open is allowed) hardware counters per message.
+//
+//   make bench && bench/MessageQueueBench [messages per run (default 1000000)] [scenario name to run only that one]
+#include "../include/MessageQueue.hpp"
+#include <thread>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace {
+  int64_t nanos() {
+    timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return int64_t(tp.tv_sec) * 1000 * 1000 * 1000 + tp.tv_nsec;
+  }
+
+  void pin(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+
+  // waits without starving a thread pinned to the same CPU
+  void relax(int& spins) {
+    if (++spins > 64) {
+      sched_yield();
+      spins = 0;
+    }
+  }
+
+  struct Cpu { int id, core, package; };
+
+  std::vector<Cpu> readTopology() {
+    std::vector<Cpu> cpus;
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int id = 0; id < CPU_SETSIZE; ++id) {
+      if (!CPU_ISSET(id, &allowed)) continue;
+      std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+      Cpu c = { id, -1, -1 };
+      std::ifstream(dir + "core_id") >> c.core;
+      std::ifstream(dir + "physical_package_id") >> c.package;
+      cpus.push_back(c);
+    }
+    return cpus;
+  }
+
+  enum Scenario { SPSC, MPSC, FANOUT };
+  const char* scenarioNames[] = { "spsc", "mpsc-locked", "fanout" };
+  constexpr int MPSC_WRITERS = 2;
+  constexpr int FANOUT_READERS = 2;
+
+  // where the writer(s) & reader(s) run: every reader on readerCpu & writer i on writerCpus[i]. The placement names
+  // where the reader is relative to the first writer; any others get CPUs of their own (on the first writer's socket
+  // where there are enough), so MPSC writers contend on the queue rather than for a CPU
+  struct Placement {
+    const char* name;
+    std::vector<int> writerCpus;
+    int readerCpu;
+  };
+
+  std::vector<Placement> placements(const std::vector<Cpu>& cpus) {
+    std::vector<Placement> ret;
+    if (cpus.empty()) return ret;
+    const Cpu& w = cpus.front();
+    auto add = [&](const char* name, int readerCpu) {
+      std::vector<const Cpu*> others;
+      for (const auto& c: cpus) if (c.id != w.id && c.id != readerCpu) others.push_back(&c);
+      std::stable_sort(others.begin(), others.end(), [&](const Cpu* a, const Cpu* b) {
+        return (a->package == w.package) > (b->package == w.package);
+      });
+      Placement p = { name, { w.id }, readerCpu };
+      for (int i = 1; i < MPSC_WRITERS; ++i) {
+        if (size_t(i - 1) < others.size()) {
+          p.writerCpus.push_back(others[i - 1]->id);
+        } else {
+          fprintf(stderr, "(not enough CPUs for a writer each in the %s placement: writer %d shares CPU %d)\n",
+              name, i, w.id);
+          p.writerCpus.push_back(w.id);
+        }
+      }
+      ret.push_back(p);
+    };
+    add("same-core", w.id);
+    auto find = [&](auto pred, const char* name) {
+      for (const auto& c: cpus) {
+        if (c.id != w.id && pred(c)) {
+          add(name, c.id);
+          return;
+        }
+      }
+      fprintf(stderr, "(no CPU for %s placement on this machine)\n", name);
+    };
+    find([&](const Cpu& c) { return c.package == w.package && c.core == w.core; }, "sibling-ht");
+    find([&](const Cpu& c) { return c.package == w.package && c.core != w.core; }, "cross-core");
+    find([&](const Cpu& c) { return c.package != w.package; }, "cross-socket");
+    return ret;
+  }
+
+  // per thread (user space) hardware counters. Any the kernel won't give us read as -1
+  struct PerfCounters {
+    static constexpr int N = 3;
+    static constexpr const char* names[N] = { "cache-miss", "LLC-load", "br-miss" };
+    PerfCounters() {
+      const std::pair<uint32_t, uint64_t> events[N] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+      };
+      for (int i = 0; i < N; ++i) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].first;
+        attr.config = events[i].second;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+      }
+    }
+    ~PerfCounters() {
+      for (int fd: _fd) if (fd >= 0) close(fd);
+    }
+    void start() {
+      for (int fd: _fd) {
+        if (fd < 0) continue;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+    void stop(int64_t* values) {
+      for (int i = 0; i < N; ++i) {
+        uint64_t v = 0;
+        if (_fd[i] >= 0) ioctl(_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        values[i] = (_fd[i] >= 0 && read(_fd[i], &v, sizeof(v)) == sizeof(v)) ? int64_t(v) : -1;
+      }
+    }
+    int _fd[N];
+  };
+
+  // the start of every slot. The rest of the slot (up to the payload size) is filled by the writer & summed by the reader
+  struct Header {
+    int64_t seq;
+    int64_t sentNanos;
+  };
+  // a MessageQueue's slot: the payload size is part of its type (a RuntimeMessageQueue<Header> is given it instead)
+  template <size_t PAYLOAD> struct Slot {
+    static_assert(PAYLOAD >= sizeof(Header));
+    alignas(Header) char bytes[PAYLOAD];
+  };
+
+  struct Result {
+    double seconds = 0;
+    std::vector<int64_t> latencies; // every message each reader received
+    int64_t counters[PerfCounters::N] = { 0, 0, 0 };
+  };
+
+  // q is either queue: both hand out the slot as a reference to its payload type, which the Header starts
+  template <typename Queue>
+    Result run(Queue& q, Scenario scenario, size_t payload, size_t capacity, const Placement& placement, int64_t messages) {
+    int writers = (scenario == MPSC) ? MPSC_WRITERS : 1;
+    int readers = (scenario == FANOUT) ? FANOUT_READERS : 1;
+    std::vector<std::atomic<int64_t>> readCounts(readers);
+    for (auto& r: readCounts) r = 0;
+    std::vector<std::vector<int64_t>> latencies(readers, std::vector<int64_t>(messages));
+    std::vector<std::array<int64_t, PerfCounters::N>> counters(writers + readers);
+    std::vector<int64_t> finished(readers);
+    std::atomic<int> ready = 0;
+    std::atomic<bool> go = false;
+    int64_t start = 0;
+    volatile uint64_t checksum = 0;
+    auto startTogether = [&](PerfCounters& pc) {
+      ++ready;
+      while (!go) sched_yield();
+      pc.start();
+    };
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; ++w) {
+      threads.emplace_back([&, w]() {
+        pin(placement.writerCpus[w]);
+        PerfCounters pc;
+        startTogether(pc);
+        int64_t margin = capacity - writers - 1; // (each writer may have one write in flight past its check)
+        for (int64_t i = w; i < messages; i += writers) {
+          int spins = 0;
+          while (true) { // don't lap the slowest reader
+            int64_t slowest = INT64_MAX;
+            for (auto& r: readCounts) slowest = std::min<int64_t>(slowest, r.load(std::memory_order_acquire));
+            if (q.writeCount() - slowest < margin) break;
+            relax(spins);
+          }
+          auto fill = [&](void* slot) {
+            Header* h = static_cast<Header*>(slot);
+            memset(reinterpret_cast<char*>(h) + sizeof(Header), int(i), payload - sizeof(Header));
+            h->seq = i;
+            h->sentNanos = nanos();
+          };
+          if (scenario == MPSC) {
+            auto wrt = q.nextWriteSlotLocked();
+            fill(&*wrt);
+          } else {
+            auto wrt = q.nextWriteSlot();
+            fill(&*wrt);
+          }
+        }
+        pc.stop(counters[w].data());
+      });
+    }
+    for (int r = 0; r < readers; ++r) {
+      threads.emplace_back([&, r]() {
+        pin(placement.readerCpu);
+        PerfCounters pc;
+        startTogether(pc);
+        uint64_t sum = 0;
+        int spins = 0;
+        for (int64_t got = 0; got < messages;) {
+          auto msg = q.recv(readCounts[r]);
+          if (!msg) {
+            relax(spins);
+            continue;
+          }
+          const Header* h = reinterpret_cast<const Header*>(&*msg);
+          latencies[r][got++] = nanos() - h->sentNanos;
+          const unsigned char* p = reinterpret_cast<const unsigned char*>(h) + sizeof(Header);
+          for (size_t i = 0; i < payload - sizeof(Header); i += sizeof(uint64_t)) sum += p[i];
+        }
+        finished[r] = nanos();
+        pc.stop(counters[writers + r].data());
+        checksum = checksum + sum;
+      });
+    }
+    while (ready != writers + readers) sched_yield();
+    start = nanos();
+    go = true;
+    for (auto& t: threads) t.join();
+
+    Result result;
+    result.seconds = (*std::max_element(finished.begin(), finished.end()) - start) / 1e9;
+    for (auto& l: latencies) result.latencies.insert(result.latencies.end(), l.begin(), l.end());
+    for (const auto& c: counters) {
+      for (int i = 0; i < PerfCounters::N; ++i) {
+        result.counters[i] = (c[i] < 0 || result.counters[i] < 0) ? -1 : result.counters[i] + c[i];
+      }
+    }
+    return result;
+  }
+
+  void report(const char* queue, Scenario scenario, size_t payload, size_t capacity, const Placement& placement,
+      int64_t messages, Result& r) {
+    std::sort(r.latencies.begin(), r.latencies.end());
+    auto pct = [&](double p) { return r.latencies[std::min(r.latencies.size() - 1, size_t(p * r.latencies.size()))]; };
+    printf("%-8s %-12s %-12s %7zu %8zu %8.2f %7ld %7ld %7ld %8ld %9ld", queue, scenarioNames[scenario], placement.name,
+        payload, capacity, messages / r.seconds / 1e6, pct(0.5), pct(0.9), pct(0.99), pct(0.999), r.latencies.back());
+    for (int64_t c: r.counters) {
+      if (c < 0) {
+        printf(" %10s", "n/a");
+      } else {
+        printf(" %10.3f", double(c) / messages);
+      }
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+
+  // each queue in turn, with the same payload & capacity
+  template <size_t PAYLOAD, size_t CAPACITY>
+    void runQueues(Scenario scenario, const Placement& placement, int64_t messages) {
+      {
+        Salvo::RuntimeMessageQueue<Header> q(CAPACITY, PAYLOAD);
+        Result r = run(q, scenario, PAYLOAD, CAPACITY, placement, messages);
+        report("runtime", scenario, PAYLOAD, CAPACITY, placement, messages, r);
+      }
+      {
+        auto q = std::make_unique<Salvo::MessageQueue<Slot<PAYLOAD>, CAPACITY>>(); // (too big for the stack)
+        Result r = run(*q, scenario, PAYLOAD, CAPACITY, placement, messages);
+        report("static", scenario, PAYLOAD, CAPACITY, placement, messages, r);
+      }
+    }
+
+  template <size_t PAYLOAD> void runCapacities(Scenario scenario, const Placement& placement, int64_t messages) {
+    runQueues<PAYLOAD, 1 << 10>(scenario, placement, messages);
+    runQueues<PAYLOAD, 1 << 16>(scenario, placement, messages);
+  }
+}
+
+int main(int argc, char** argv) {
+  int64_t messages = (argc > 1) ? atoll(argv[1]) : 1000 * 1000;
+  const char* only = (argc > 2) ? argv[2] : nullptr;
+  auto cpus = readTopology();
+  printf("# %ld messages per run; latencies (ns) are from just before publishing to just after receiving, & include the\n"
+      "# two clock reads. Counters are per message, summed over every thread in the run\n", messages);
+  printf("%-8s %-12s %-12s %7s %8s %8s %7s %7s %7s %8s %9s", "queue", "scenario", "placement", "payload", "capacity",
+      "Mmsg/s", "p50", "p90", "p99", "p99.9", "max");
+  for (const char* name: PerfCounters::names) printf(" %10s", name);
+  printf("\n");
+  for (Scenario scenario: { SPSC, MPSC, FANOUT }) {
+    if (only && strcmp(only, scenarioNames[scenario]) != 0) continue;
+    for (const auto& placement: placements(cpus)) {
+      runCapacities<16>(scenario, placement, messages);
+      runCapacities<64>(scenario, placement, messages);
+      runCapacities<256>(scenario, placement, messages);
+      runCapacities<1024>(scenario, placement, messages);
+    }
+  }
+  return 0;
+}
@@ -89,6 +89,92 @@ BOOST_AUTO_TEST_CASE( MessageQueueTest )
     // catch up
     while (mq.recv(readcount)) { }
   }
+  { // runtime sized, with slots bigger than the payload type
+    RuntimeMessageQueue<NODE> rmq(8, sizeof(NODE) + 100);
+    BOOST_REQUIRE(rmq.capacity() == 8);
+    BOOST_REQUIRE(rmq.slotSize() == sizeof(NODE) + 100);
+    BOOST_CHECK_THROW(RuntimeMessageQueue<NODE>(12), std::invalid_argument);
+    std::atomic<int64_t> rmqReadcount = 0;
+    BOOST_REQUIRE(!rmq.recv(rmqReadcount));
+    for (int i = 0; i < 100; ++i) {
+      {
+        auto wrt = rmq.nextWriteSlot();
+        wrt->i = i;
+        memset(reinterpret_cast<char*>(&*wrt) + sizeof(NODE), i, 100);
+        if (i % 3 == 0) wrt.abandon();
+      }
+      auto msg = rmq.recv(rmqReadcount);
+      if (i % 3 == 0) {
+        BOOST_REQUIRE(!msg);
+      } else {
+        BOOST_REQUIRE(msg);
+        BOOST_REQUIRE(msg->i == i);
+        BOOST_REQUIRE(reinterpret_cast<const char*>(&*msg)[sizeof(NODE) + 99] == char(i));
+      }
+    }
+    BOOST_REQUIRE(rmqReadcount == rmq.writeCount());
+  }
+  struct SMALL {
+    int i;
+  };
+  { // runtime sized in caller supplied (shared) storage, attached to from a second queue object
+    size_t bytes = RuntimeMessageQueue<SMALL>::storageSize(16, 64);
+    void* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    BOOST_REQUIRE(mem != MAP_FAILED);
+    memset(mem, 0xff, bytes); // i.e., CREATE mustn't rely on zeroed memory
+    RuntimeMessageQueue<SMALL> writer(mem, RuntimeMessageQueue<SMALL>::CREATE, 16, 64);
+    RuntimeMessageQueue<SMALL> reader(mem, RuntimeMessageQueue<SMALL>::ATTACH, 16, 64);
+    BOOST_CHECK_THROW(RuntimeMessageQueue<SMALL>(mem, RuntimeMessageQueue<SMALL>::ATTACH, 32, 64), std::runtime_error);
+    BOOST_CHECK_THROW(RuntimeMessageQueue<SMALL>(mem, RuntimeMessageQueue<SMALL>::ATTACH, 16, 128), std::runtime_error);
+    BOOST_CHECK_THROW(RuntimeMessageQueue<int64_t>(mem, RuntimeMessageQueue<int64_t>::ATTACH, 16, 64), std::runtime_error);
+    BOOST_CHECK_THROW(RuntimeMessageQueue<SMALL>((char*)mem + 8, RuntimeMessageQueue<SMALL>::CREATE, 16, 64), std::invalid_argument);
+    std::atomic<int64_t> readcount = 0;
+    for (int i = 0; i < 40; ++i) {
+      writer.push_back(SMALL{i});
+      auto msg = reader.recv(readcount);
+      BOOST_REQUIRE(msg);
+      BOOST_REQUIRE(msg->i == i);
+    }
+    BOOST_REQUIRE(reader.writeCount() == 40);
+    { // a locked write that's abandoned leaves nothing behind
+      auto wrt = writer.nextWriteSlotLocked();
+      wrt->i = -1;
+      BOOST_REQUIRE(!reader.recv(readcount));
+      wrt.abandon();
+    }
+    BOOST_REQUIRE(!reader.recv(readcount));
+    writer.push_back_locked(SMALL{40});
+    BOOST_REQUIRE(reader.recv(readcount)->i == 40);
+
+    RuntimeMessageQueue<SMALL> named(mem, RuntimeMessageQueue<SMALL>::CREATE, 16, 64, "Node");
+    BOOST_CHECK_NO_THROW(named.confirmHeader("Node"));
+    BOOST_CHECK_THROW(named.confirmHeader("Other"), std::runtime_error);
+    munmap(mem, bytes);
+  }
+  { // several threads writing with locked handles, each slot locked in place
+    constexpr int WRITERS = 4, EACH = 20000;
+    RuntimeMessageQueue<SMALL> rmq(1 << 17, 64); // (room for everything, as nothing reads until the end)
+    std::vector<std::thread> writers;
+    for (int w = 0; w < WRITERS; ++w) {
+      writers.push_back(std::thread([w, &rmq]() {
+        for (int i = 0; i < EACH; ++i) {
+          auto wrt = rmq.nextWriteSlotLocked();
+          wrt->i = w * EACH + i;
+        }
+      }));
+    }
+    for (auto& t: writers) t.join();
+    std::atomic<int64_t> readcount = 0;
+    std::vector<int> last(WRITERS, -1);
+    int64_t n = 0;
+    while (auto msg = rmq.recv(readcount)) {
+      int w = msg->i / EACH;
+      BOOST_REQUIRE(msg->i % EACH > last[w]); // each writer's records in order, none lost or duplicated
+      last[w] = msg->i % EACH;
+      ++n;
+    }
+    BOOST_REQUIRE(n == WRITERS * EACH);
+  }
   // Racing threads test
 
   {
@@ -0,0 +1,61 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+// Lists & switches the logging call sites of a running process started with Logging::Config::siteControl set.
+//
+//   logctl trader                        lists every site that's run so far: on/off file:line "format"
+//   logctl trader off Feed.cpp           switches off every site in Feed.cpp ("*" for all, or file:line for one)
+//   logctl trader on Feed.cpp:120 ...
+#include "../include/LoggingSites.hpp"
+#include <stdio.h>
+
+int main(int argc, char** argv) {
+  bool list = (argc == 2) || (argc == 3 && strcmp(argv[2], "list") == 0);
+  bool set = (argc >= 4) && (strcmp(argv[2], "on") == 0 || strcmp(argv[2], "off") == 0);
+  if (!list && !set) {
+    fprintf(stderr, "usage: %s <name> [list]\n       %s <name> on|off <* | file | file:line>...\n", argv[0], argv[0]);
+    return 2;
+  }
+  try {
+    auto* table = LoggingHelper::SiteTable::open(argv[1]);
+    if (list) {
+      uint32_t count = std::min(table->header.count.load(std::memory_order_acquire), LoggingHelper::SiteTable::CAPACITY);
+      printf("# pid %d, %u sites\n", table->header.pid, count);
+      for (uint32_t i = 0; i < count; ++i) {
+        const auto& e = table->entries[i];
+        printf("%-3s %s:%d \"", table->off[i].load() ? "off" : "on", e.file, e.line);
+        for (const char* c = e.format; *c; ++c) {
+          if (*c == '\n') {
+            printf("\\n");
+          } else {
+            putchar(*c);
+          }
+        }
+        printf("\"\n");
+      }
+      return 0;
+    }
+    bool on = (strcmp(argv[2], "on") == 0);
+    for (int i = 3; i < argc; ++i) {
+      size_t n = LoggingHelper::SiteTable::set(table, argv[i], on);
+      printf("%s: %zu site%s switched %s\n", argv[i], n, n == 1 ? "" : "s", on ? "on" : "off");
+    }
+  } catch (const std::exception& e) {
+    fprintf(stderr, "logctl: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
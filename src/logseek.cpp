@@ -0,0 +1,157 @@
+/**
+  * Copyright (C) 2020 Salvo Limited Hong Kong
+  *
+  *  Licensed under the Apache License, Version 2.0 (the "License");
+  *  you may not use this file except in compliance with the License.
+  *  You may obtain a copy of the License at
+  *
+  *      http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *  Unless required by applicable law or agreed to in writing, software
+  *  distributed under the License is distributed on an "AS IS" BASIS,
+  *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *  See the License for the specific language governing permissions and
+  *  limitations under the License.
+  *
+***/
+// Prints the lines of a log file written between two times, using the <file>.idx a RotatingFileSink writes with
+// RotatingFileConfig::indexMillis set to go straight to the parts of the file that could hold them (both are mmapped).
+// Lines aren't strictly in time order (lanes & producers interleave), so every index bucket whose earliest..latest
+// times overlap the range is read, & each line's own time decides whether it's printed.
+//
+//   logseek trades.log.3 09:30:00 09:30:00.250   (UTC times of day: see parseArg() for which day)
+//   logseek trades.log.3 23:59:50 00:00:10       (a range across midnight)
+//   logseek trades.log.3 1700040600000 1700040600250   (milliseconds since the epoch)
+#include "../include/LoggingSink.hpp"
+#include <sys/mman.h>
+#include <algorithm>
+
+namespace {
+  constexpr int64_t DAY = 24LL * 60 * 60 * 1000 * 1000;
+
+  struct Mapped {
+    explicit Mapped(const std::string& name) {
+      int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) != 0) throw std::runtime_error("can't open " + name + ": " + strerror(errno));
+      _size = st.st_size;
+      if (_size > 0) {
+        _data = static_cast<const char*>(mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0));
+        if (_data == MAP_FAILED) throw std::runtime_error("can't mmap " + name + ": " + strerror(errno));
+      }
+      ::close(fd);
+    }
+    ~Mapped() { if (_size > 0) munmap(const_cast<char*>(_data), _size); }
+    const char* _data = nullptr;
+    size_t _size = 0;
+  };
+
+  // "HH:MM:SS[.fraction]" as micros since midnight, or -1
+  int64_t parseTimeOfDay(const char* p, const char* end, const char** after = nullptr) {
+    int h, m, s;
+    if (end - p < 8 || p[2] != ':' || p[5] != ':') return -1;
+    for (int i: { 0, 1, 3, 4, 6, 7 }) if (p[i] < '0' || p[i] > '9') return -1;
+    h = (p[0] - '0') * 10 + p[1] - '0';
+    m = (p[3] - '0') * 10 + p[4] - '0';
+    s = (p[6] - '0') * 10 + p[7] - '0';
+    int64_t micros = ((h * 60LL + m) * 60 + s) * 1000 * 1000;
+    p += 8;
+    if (p < end && *p == '.') {
+      int64_t scale = 100000;
+      for (++p; p < end && *p >= '0' && *p <= '9'; ++p, scale /= 10) micros += (*p - '0') * scale;
+    }
+    if (after) *after = p;
+    return micros;
+  }
+
+  // a time of day near 'near' (epoch micros) as epoch micros
+  int64_t nearest(int64_t timeOfDay, int64_t near) {
+    int64_t ret = near / DAY * DAY + timeOfDay;
+    if (ret - near > DAY / 2) return ret - DAY;
+    if (near - ret > DAY / 2) return ret + DAY;
+    return ret;
+  }
+
+  // epoch micros for epoch milliseconds, or -1 for a time of day (returned in tod)
+  int64_t parseArg(const char* arg, int64_t& tod) {
+    tod = -1;
+    if (strchr(arg, ':') != nullptr) {
+      const char* end = arg + strlen(arg);
+      const char* after = nullptr;
+      tod = parseTimeOfDay(arg, end, &after);
+      if (tod < 0 || after != end) throw std::invalid_argument(std::string("bad time '") + arg + "'");
+      return -1;
+    }
+    char* end = nullptr;
+    int64_t ms = strtoll(arg, &end, 10);
+    if (*arg == 0 || *end != 0) throw std::invalid_argument(std::string("bad time '") + arg + "'");
+    return ms * 1000;
+  }
+
+  // the range from..to as epoch micros. A time of day 'to' is its first occurrence at or after the file's first line
+  // (start), & a time of day 'from' its last occurrence at or before 'to', so e.g. 23:59:50 00:00:10 is the 20 seconds
+  // across midnight wherever the file starts
+  std::pair<int64_t, int64_t> parseRange(const char* fromArg, const char* toArg, int64_t start) {
+    int64_t fromTod, toTod;
+    int64_t from = parseArg(fromArg, fromTod);
+    int64_t to = parseArg(toArg, toTod);
+    if (to < 0) {
+      to = start / DAY * DAY + toTod;
+      if (to < start) to += DAY;
+    }
+    if (from < 0) {
+      from = to / DAY * DAY + fromTod;
+      if (from > to) from -= DAY;
+    }
+    return { from, to };
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s <log file> <from> <to>\n"
+        "  times are milliseconds since the epoch, or HH:MM:SS[.fff] (UTC: <to> is the first such time after the file\n"
+        "  starts, & <from> the last such time at or before <to>, so a range may cross midnight)\n", argv[0]);
+    return 2;
+  }
+  try {
+    Mapped log(argv[1]);
+    Mapped idx(std::string(argv[1]) + ".idx");
+    const auto* entries = reinterpret_cast<const LoggingHelper::IndexEntry*>(idx._data);
+    size_t n = idx._size / sizeof(LoggingHelper::IndexEntry);
+    if (n == 0) throw std::runtime_error(std::string(argv[1]) + ".idx has no entries");
+    int64_t start = entries[0].minMicros;
+    for (size_t i = 1; i < n; ++i) start = std::min(start, entries[i].minMicros);
+    auto [from, to] = parseRange(argv[2], argv[3], start);
+
+    // each run of buckets that could hold a line in range (the index is small next to the file, so is just walked)
+    for (size_t i = 0; i < n;) {
+      if (entries[i].maxMicros < from || entries[i].minMicros > to) {
+        ++i;
+        continue;
+      }
+      size_t j = i + 1;
+      while (j < n && entries[j].maxMicros >= from && entries[j].minMicros <= to) ++j;
+      size_t begin = std::min<size_t>(entries[i].offset, log._size);
+      size_t end = (j == n) ? log._size : std::min<size_t>(entries[j].offset, log._size);
+
+      // then just the lines in range (those without a timestamp, e.g. LOG_HEX dumps, go with the line before)
+      int64_t t = entries[i].micros;
+      const char* p = log._data + begin;
+      const char* stop = log._data + end;
+      while (p < stop) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', stop - p));
+        eol = eol ? eol + 1 : stop;
+        int64_t tod = parseTimeOfDay(p, eol);
+        if (tod >= 0) t = nearest(tod, t);
+        if (t >= from && t <= to) fwrite(p, eol - p, 1, stdout);
+        p = eol;
+      }
+      i = j;
+    }
+  } catch (const std::exception& e) {
+    fprintf(stderr, "logseek: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}